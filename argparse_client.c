@@ -5,7 +5,7 @@
  *
  *   Do not edit it by hand, your changes will be overwritten.
  *
- *   Generated at: 2021-06-27 13:24:40
+ *   Generated at: 2026-10-17 17:30:52
  */
 
 #include <stdint.h>
@@ -23,6 +23,11 @@ static char last_error_message[256];
 static const char *option_texts[] = {
 	[ARG_CLIENT_TIMEOUT] = "-t / --timeout",
 	[ARG_CLIENT_PORT] = "-p / --port",
+	[ARG_CLIENT_MAX_BROADCAST_INTERVAL] = "--max-broadcast-interval",
+	[ARG_CLIENT_DISCOVERY_WINDOW] = "-w / --discovery-window",
+	[ARG_CLIENT_CONNECT_STAGGER] = "--connect-stagger",
+	[ARG_CLIENT_CONNECT_TIMEOUT] = "--connect-timeout",
+	[ARG_CLIENT_PARALLEL] = "-j / --parallel",
 	[ARG_CLIENT_NO_LUKS] = "--no-luks",
 	[ARG_CLIENT_VERBOSE] = "-v / --verbose",
 	[ARG_CLIENT_FILENAME] = "filename",
@@ -32,13 +37,20 @@ static const char *option_texts[] = {
 enum argparse_client_option_internal_t {
 	ARG_CLIENT_TIMEOUT_SHORT = 't',
 	ARG_CLIENT_PORT_SHORT = 'p',
+	ARG_CLIENT_DISCOVERY_WINDOW_SHORT = 'w',
+	ARG_CLIENT_PARALLEL_SHORT = 'j',
 	ARG_CLIENT_VERBOSE_SHORT = 'v',
 	ARG_CLIENT_TIMEOUT_LONG = 1000,
 	ARG_CLIENT_PORT_LONG = 1001,
-	ARG_CLIENT_NO_LUKS_LONG = 1002,
-	ARG_CLIENT_VERBOSE_LONG = 1003,
-	ARG_CLIENT_FILENAME_LONG = 1004,
-	ARG_CLIENT_HOSTNAME_LONG = 1005,
+	ARG_CLIENT_MAX_BROADCAST_INTERVAL_LONG = 1002,
+	ARG_CLIENT_DISCOVERY_WINDOW_LONG = 1003,
+	ARG_CLIENT_CONNECT_STAGGER_LONG = 1004,
+	ARG_CLIENT_CONNECT_TIMEOUT_LONG = 1005,
+	ARG_CLIENT_PARALLEL_LONG = 1006,
+	ARG_CLIENT_NO_LUKS_LONG = 1007,
+	ARG_CLIENT_VERBOSE_LONG = 1008,
+	ARG_CLIENT_FILENAME_LONG = 1009,
+	ARG_CLIENT_HOSTNAME_LONG = 1010,
 };
 
 static void errmsg_callback(const char *errmsg, ...) {
@@ -59,10 +71,15 @@ static void errmsg_option_callback(enum argparse_client_option_t error_option, c
 
 bool argparse_client_parse(int argc, char **argv, argparse_client_callback_t argument_callback, argparse_client_plausibilization_callback_t plausibilization_callback) {
 	last_parsed_option = ARGPARSE_CLIENT_NO_OPTION;
-	const char *short_options = "t:p:v";
+	const char *short_options = "t:p:w:j:v";
 	struct option long_options[] = {
 		{ "timeout",                          required_argument, 0, ARG_CLIENT_TIMEOUT_LONG },
 		{ "port",                             required_argument, 0, ARG_CLIENT_PORT_LONG },
+		{ "max-broadcast-interval",           required_argument, 0, ARG_CLIENT_MAX_BROADCAST_INTERVAL_LONG },
+		{ "discovery-window",                 required_argument, 0, ARG_CLIENT_DISCOVERY_WINDOW_LONG },
+		{ "connect-stagger",                  required_argument, 0, ARG_CLIENT_CONNECT_STAGGER_LONG },
+		{ "connect-timeout",                  required_argument, 0, ARG_CLIENT_CONNECT_TIMEOUT_LONG },
+		{ "parallel",                         required_argument, 0, ARG_CLIENT_PARALLEL_LONG },
 		{ "no-luks",                          no_argument, 0, ARG_CLIENT_NO_LUKS_LONG },
 		{ "verbose",                          no_argument, 0, ARG_CLIENT_VERBOSE_LONG },
 		{ "filename",                         required_argument, 0, ARG_CLIENT_FILENAME_LONG },
@@ -94,6 +111,43 @@ bool argparse_client_parse(int argc, char **argv, argparse_client_callback_t arg
 				}
 				break;
 
+			case ARG_CLIENT_MAX_BROADCAST_INTERVAL_LONG:
+				last_parsed_option = ARG_CLIENT_MAX_BROADCAST_INTERVAL;
+				if (!argument_callback(ARG_CLIENT_MAX_BROADCAST_INTERVAL, optarg, errmsg_callback)) {
+					return false;
+				}
+				break;
+
+			case ARG_CLIENT_DISCOVERY_WINDOW_SHORT:
+			case ARG_CLIENT_DISCOVERY_WINDOW_LONG:
+				last_parsed_option = ARG_CLIENT_DISCOVERY_WINDOW;
+				if (!argument_callback(ARG_CLIENT_DISCOVERY_WINDOW, optarg, errmsg_callback)) {
+					return false;
+				}
+				break;
+
+			case ARG_CLIENT_CONNECT_STAGGER_LONG:
+				last_parsed_option = ARG_CLIENT_CONNECT_STAGGER;
+				if (!argument_callback(ARG_CLIENT_CONNECT_STAGGER, optarg, errmsg_callback)) {
+					return false;
+				}
+				break;
+
+			case ARG_CLIENT_CONNECT_TIMEOUT_LONG:
+				last_parsed_option = ARG_CLIENT_CONNECT_TIMEOUT;
+				if (!argument_callback(ARG_CLIENT_CONNECT_TIMEOUT, optarg, errmsg_callback)) {
+					return false;
+				}
+				break;
+
+			case ARG_CLIENT_PARALLEL_SHORT:
+			case ARG_CLIENT_PARALLEL_LONG:
+				last_parsed_option = ARG_CLIENT_PARALLEL;
+				if (!argument_callback(ARG_CLIENT_PARALLEL, optarg, errmsg_callback)) {
+					return false;
+				}
+				break;
+
 			case ARG_CLIENT_NO_LUKS_LONG:
 				last_parsed_option = ARG_CLIENT_NO_LUKS;
 				if (!argument_callback(ARG_CLIENT_NO_LUKS, optarg, errmsg_callback)) {
@@ -123,10 +177,6 @@ bool argparse_client_parse(int argc, char **argv, argparse_client_callback_t arg
 		errmsg_callback("expected a minimum of 1 positional argument, but %d given.", positional_argument_cnt);
 		return false;
 	}
-	if (positional_argument_cnt > 2) {
-		errmsg_callback("expected a maximum of 2 positional arguments, but %d given.", positional_argument_cnt);
-		return false;
-	}
 
 	int positional_index = optind;
 	last_parsed_option = ARG_CLIENT_FILENAME;
@@ -149,14 +199,18 @@ bool argparse_client_parse(int argc, char **argv, argparse_client_callback_t arg
 }
 
 void argparse_client_show_syntax(void) {
-	fprintf(stderr, "usage: luksrku client [-t secs] [-p port] [--no-luks] [-v] filename [hostname]\n");
+	fprintf(stderr, "usage: luksrku client [-t secs] [-p port] [--max-broadcast-interval millis] [-w millis]\n");
+	fprintf(stderr, "                      [--connect-stagger millis] [--connect-timeout millis] [-j count] [--no-luks]\n");
+	fprintf(stderr, "                      [-v]\n");
+	fprintf(stderr, "                      filename [hostname ...]\n");
 	fprintf(stderr, "\n");
 	fprintf(stderr, "Connects to a luksrku key server and unlocks local LUKS volumes.\n");
 	fprintf(stderr, "\n");
 	fprintf(stderr, "positional arguments:\n");
 	fprintf(stderr, "  filename              Exported database file to load TLS-PSKs and list of disks from.\n");
-	fprintf(stderr, "  hostname              When hostname is given, auto-searching for suitable servers is disabled and\n");
-	fprintf(stderr, "                        only a connection to the given hostname is attempted.\n");
+	fprintf(stderr, "  hostname              When one or more hostnames are given, auto-searching for suitable servers is\n");
+	fprintf(stderr, "                        disabled and only connections to the given keyservers are attempted. All of\n");
+	fprintf(stderr, "                        their addresses are tried concurrently and the first one to respond is used.\n");
 	fprintf(stderr, "\n");
 	fprintf(stderr, "optional arguments:\n");
 	fprintf(stderr, "  -t secs, --timeout secs\n");
@@ -165,6 +219,25 @@ void argparse_client_show_syntax(void) {
 	fprintf(stderr, "                        argument can be specified as a host-based configuration parameter as well;\n");
 	fprintf(stderr, "                        the command-line argument always takes precedence.\n");
 	fprintf(stderr, "  -p port, --port port  Port that is used for both UDP and TCP communication. Defaults to 23170.\n");
+	fprintf(stderr, "  --max-broadcast-interval millis\n");
+	fprintf(stderr, "                        When no keyserver answers, the interval between discovery broadcasts is\n");
+	fprintf(stderr, "                        doubled after every attempt, randomized to avoid many clients broadcasting\n");
+	fprintf(stderr, "                        in lockstep. This is the ceiling of that interval. Defaults to 16000 ms.\n");
+	fprintf(stderr, "  -w millis, --discovery-window millis\n");
+	fprintf(stderr, "                        After the first keyserver answered a broadcast, wait this long for answers\n");
+	fprintf(stderr, "                        of further keyservers. They are then tried in order of their response time.\n");
+	fprintf(stderr, "                        Defaults to 100 ms.\n");
+	fprintf(stderr, "  --connect-stagger millis\n");
+	fprintf(stderr, "                        When multiple keyservers are known, start connecting to the next one after\n");
+	fprintf(stderr, "                        this time even if the previous attempts are still pending. Defaults to 250\n");
+	fprintf(stderr, "                        ms.\n");
+	fprintf(stderr, "  --connect-timeout millis\n");
+	fprintf(stderr, "                        Give up on a keyserver if connection and TLS handshake did not complete\n");
+	fprintf(stderr, "                        within this time. Defaults to 5000 ms.\n");
+	fprintf(stderr, "  -j count, --parallel count\n");
+	fprintf(stderr, "                        Number of LUKS volumes that are unlocked concurrently once the keys have\n");
+	fprintf(stderr, "                        been received. Note that every unlock operation may require a significant\n");
+	fprintf(stderr, "                        amount of memory for Argon2 key derivation. Defaults to 2.\n");
 	fprintf(stderr, "  --no-luks             Do not call LUKS/cryptsetup. Useful for testing unlocking procedure.\n");
 	fprintf(stderr, "  -v, --verbose         Increase verbosity. Can be specified multiple times.\n");
 }
@@ -193,6 +266,11 @@ static const char *option_enum_to_str(enum argparse_client_option_t option) {
 	switch (option) {
 		case ARG_CLIENT_TIMEOUT: return "ARG_CLIENT_TIMEOUT";
 		case ARG_CLIENT_PORT: return "ARG_CLIENT_PORT";
+		case ARG_CLIENT_MAX_BROADCAST_INTERVAL: return "ARG_CLIENT_MAX_BROADCAST_INTERVAL";
+		case ARG_CLIENT_DISCOVERY_WINDOW: return "ARG_CLIENT_DISCOVERY_WINDOW";
+		case ARG_CLIENT_CONNECT_STAGGER: return "ARG_CLIENT_CONNECT_STAGGER";
+		case ARG_CLIENT_CONNECT_TIMEOUT: return "ARG_CLIENT_CONNECT_TIMEOUT";
+		case ARG_CLIENT_PARALLEL: return "ARG_CLIENT_PARALLEL";
 		case ARG_CLIENT_NO_LUKS: return "ARG_CLIENT_NO_LUKS";
 		case ARG_CLIENT_VERBOSE: return "ARG_CLIENT_VERBOSE";
 		case ARG_CLIENT_FILENAME: return "ARG_CLIENT_FILENAME";
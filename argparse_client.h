@@ -5,7 +5,7 @@
  *
  *   Do not edit it by hand, your changes will be overwritten.
  *
- *   Generated at: 2021-06-27 13:24:40
+ *   Generated at: 2026-10-17 17:30:52
  */
 
 #ifndef __ARGPARSE_CLIENT_H__
@@ -15,6 +15,11 @@
 
 #define ARGPARSE_CLIENT_DEFAULT_TIMEOUT		0
 #define ARGPARSE_CLIENT_DEFAULT_PORT		23170
+#define ARGPARSE_CLIENT_DEFAULT_MAX_BROADCAST_INTERVAL		16000
+#define ARGPARSE_CLIENT_DEFAULT_DISCOVERY_WINDOW		100
+#define ARGPARSE_CLIENT_DEFAULT_CONNECT_STAGGER		250
+#define ARGPARSE_CLIENT_DEFAULT_CONNECT_TIMEOUT		5000
+#define ARGPARSE_CLIENT_DEFAULT_PARALLEL		2
 #define ARGPARSE_CLIENT_DEFAULT_VERBOSE		0
 
 #define ARGPARSE_CLIENT_NO_OPTION		0
@@ -23,10 +28,15 @@
 enum argparse_client_option_t {
 	ARG_CLIENT_TIMEOUT = 2,
 	ARG_CLIENT_PORT = 3,
-	ARG_CLIENT_NO_LUKS = 4,
-	ARG_CLIENT_VERBOSE = 5,
-	ARG_CLIENT_FILENAME = 6,
-	ARG_CLIENT_HOSTNAME = 7,
+	ARG_CLIENT_MAX_BROADCAST_INTERVAL = 4,
+	ARG_CLIENT_DISCOVERY_WINDOW = 5,
+	ARG_CLIENT_CONNECT_STAGGER = 6,
+	ARG_CLIENT_CONNECT_TIMEOUT = 7,
+	ARG_CLIENT_PARALLEL = 8,
+	ARG_CLIENT_NO_LUKS = 9,
+	ARG_CLIENT_VERBOSE = 10,
+	ARG_CLIENT_FILENAME = 11,
+	ARG_CLIENT_HOSTNAME = 12,
 };
 
 typedef void (*argparse_client_errmsg_callback_t)(const char *errmsg, ...);
@@ -5,7 +5,7 @@
  *
  *   Do not edit it by hand, your changes will be overwritten.
  *
- *   Generated at: 2021-06-27 13:24:40
+ *   Generated at: 2026-10-17 20:04:51
  */
 
 #include <stdint.h>
@@ -23,6 +23,16 @@ static char last_error_message[256];
 static const char *option_texts[] = {
 	[ARG_SERVER_PORT] = "-p / --port",
 	[ARG_SERVER_SILENT] = "-s / --silent",
+	[ARG_SERVER_ENGINE] = "-e / --engine",
+	[ARG_SERVER_THREADS] = "-t / --threads",
+	[ARG_SERVER_QUEUE_DEPTH] = "-q / --queue-depth",
+	[ARG_SERVER_ACCEPTORS] = "-a / --acceptors",
+	[ARG_SERVER_BACKLOG] = "-b / --backlog",
+	[ARG_SERVER_VAULT_SHARDS] = "--vault-shards",
+	[ARG_SERVER_KDF_LANES] = "--kdf-lanes",
+	[ARG_SERVER_COALESCE_WINDOW] = "--coalesce-window",
+	[ARG_SERVER_COALESCE_MAX_BATCH] = "--coalesce-max-batch",
+	[ARG_SERVER_WARM_UP_TTL] = "--warm-up-ttl",
 	[ARG_SERVER_VERBOSE] = "-v / --verbose",
 	[ARG_SERVER_FILENAME] = "filename",
 };
@@ -30,11 +40,26 @@ static const char *option_texts[] = {
 enum argparse_server_option_internal_t {
 	ARG_SERVER_PORT_SHORT = 'p',
 	ARG_SERVER_SILENT_SHORT = 's',
+	ARG_SERVER_ENGINE_SHORT = 'e',
+	ARG_SERVER_THREADS_SHORT = 't',
+	ARG_SERVER_QUEUE_DEPTH_SHORT = 'q',
+	ARG_SERVER_ACCEPTORS_SHORT = 'a',
+	ARG_SERVER_BACKLOG_SHORT = 'b',
 	ARG_SERVER_VERBOSE_SHORT = 'v',
 	ARG_SERVER_PORT_LONG = 1000,
 	ARG_SERVER_SILENT_LONG = 1001,
-	ARG_SERVER_VERBOSE_LONG = 1002,
-	ARG_SERVER_FILENAME_LONG = 1003,
+	ARG_SERVER_ENGINE_LONG = 1002,
+	ARG_SERVER_THREADS_LONG = 1003,
+	ARG_SERVER_QUEUE_DEPTH_LONG = 1004,
+	ARG_SERVER_ACCEPTORS_LONG = 1005,
+	ARG_SERVER_BACKLOG_LONG = 1006,
+	ARG_SERVER_VAULT_SHARDS_LONG = 1007,
+	ARG_SERVER_KDF_LANES_LONG = 1008,
+	ARG_SERVER_COALESCE_WINDOW_LONG = 1009,
+	ARG_SERVER_COALESCE_MAX_BATCH_LONG = 1010,
+	ARG_SERVER_WARM_UP_TTL_LONG = 1011,
+	ARG_SERVER_VERBOSE_LONG = 1012,
+	ARG_SERVER_FILENAME_LONG = 1013,
 };
 
 static void errmsg_callback(const char *errmsg, ...) {
@@ -55,10 +80,20 @@ static void errmsg_option_callback(enum argparse_server_option_t error_option, c
 
 bool argparse_server_parse(int argc, char **argv, argparse_server_callback_t argument_callback, argparse_server_plausibilization_callback_t plausibilization_callback) {
 	last_parsed_option = ARGPARSE_SERVER_NO_OPTION;
-	const char *short_options = "p:sv";
+	const char *short_options = "p:se:t:q:a:b:v";
 	struct option long_options[] = {
 		{ "port",                             required_argument, 0, ARG_SERVER_PORT_LONG },
 		{ "silent",                           no_argument, 0, ARG_SERVER_SILENT_LONG },
+		{ "engine",                           required_argument, 0, ARG_SERVER_ENGINE_LONG },
+		{ "threads",                          required_argument, 0, ARG_SERVER_THREADS_LONG },
+		{ "queue-depth",                      required_argument, 0, ARG_SERVER_QUEUE_DEPTH_LONG },
+		{ "acceptors",                        required_argument, 0, ARG_SERVER_ACCEPTORS_LONG },
+		{ "backlog",                          required_argument, 0, ARG_SERVER_BACKLOG_LONG },
+		{ "vault-shards",                     required_argument, 0, ARG_SERVER_VAULT_SHARDS_LONG },
+		{ "kdf-lanes",                        required_argument, 0, ARG_SERVER_KDF_LANES_LONG },
+		{ "coalesce-window",                  required_argument, 0, ARG_SERVER_COALESCE_WINDOW_LONG },
+		{ "coalesce-max-batch",               required_argument, 0, ARG_SERVER_COALESCE_MAX_BATCH_LONG },
+		{ "warm-up-ttl",                      required_argument, 0, ARG_SERVER_WARM_UP_TTL_LONG },
 		{ "verbose",                          no_argument, 0, ARG_SERVER_VERBOSE_LONG },
 		{ "filename",                         required_argument, 0, ARG_SERVER_FILENAME_LONG },
 		{ 0 }
@@ -88,6 +123,81 @@ bool argparse_server_parse(int argc, char **argv, argparse_server_callback_t arg
 				}
 				break;
 
+			case ARG_SERVER_ENGINE_SHORT:
+			case ARG_SERVER_ENGINE_LONG:
+				last_parsed_option = ARG_SERVER_ENGINE;
+				if (!argument_callback(ARG_SERVER_ENGINE, optarg, errmsg_callback)) {
+					return false;
+				}
+				break;
+
+			case ARG_SERVER_THREADS_SHORT:
+			case ARG_SERVER_THREADS_LONG:
+				last_parsed_option = ARG_SERVER_THREADS;
+				if (!argument_callback(ARG_SERVER_THREADS, optarg, errmsg_callback)) {
+					return false;
+				}
+				break;
+
+			case ARG_SERVER_QUEUE_DEPTH_SHORT:
+			case ARG_SERVER_QUEUE_DEPTH_LONG:
+				last_parsed_option = ARG_SERVER_QUEUE_DEPTH;
+				if (!argument_callback(ARG_SERVER_QUEUE_DEPTH, optarg, errmsg_callback)) {
+					return false;
+				}
+				break;
+
+			case ARG_SERVER_ACCEPTORS_SHORT:
+			case ARG_SERVER_ACCEPTORS_LONG:
+				last_parsed_option = ARG_SERVER_ACCEPTORS;
+				if (!argument_callback(ARG_SERVER_ACCEPTORS, optarg, errmsg_callback)) {
+					return false;
+				}
+				break;
+
+			case ARG_SERVER_BACKLOG_SHORT:
+			case ARG_SERVER_BACKLOG_LONG:
+				last_parsed_option = ARG_SERVER_BACKLOG;
+				if (!argument_callback(ARG_SERVER_BACKLOG, optarg, errmsg_callback)) {
+					return false;
+				}
+				break;
+
+			case ARG_SERVER_VAULT_SHARDS_LONG:
+				last_parsed_option = ARG_SERVER_VAULT_SHARDS;
+				if (!argument_callback(ARG_SERVER_VAULT_SHARDS, optarg, errmsg_callback)) {
+					return false;
+				}
+				break;
+
+			case ARG_SERVER_KDF_LANES_LONG:
+				last_parsed_option = ARG_SERVER_KDF_LANES;
+				if (!argument_callback(ARG_SERVER_KDF_LANES, optarg, errmsg_callback)) {
+					return false;
+				}
+				break;
+
+			case ARG_SERVER_COALESCE_WINDOW_LONG:
+				last_parsed_option = ARG_SERVER_COALESCE_WINDOW;
+				if (!argument_callback(ARG_SERVER_COALESCE_WINDOW, optarg, errmsg_callback)) {
+					return false;
+				}
+				break;
+
+			case ARG_SERVER_COALESCE_MAX_BATCH_LONG:
+				last_parsed_option = ARG_SERVER_COALESCE_MAX_BATCH;
+				if (!argument_callback(ARG_SERVER_COALESCE_MAX_BATCH, optarg, errmsg_callback)) {
+					return false;
+				}
+				break;
+
+			case ARG_SERVER_WARM_UP_TTL_LONG:
+				last_parsed_option = ARG_SERVER_WARM_UP_TTL;
+				if (!argument_callback(ARG_SERVER_WARM_UP_TTL, optarg, errmsg_callback)) {
+					return false;
+				}
+				break;
+
 			case ARG_SERVER_VERBOSE_SHORT:
 			case ARG_SERVER_VERBOSE_LONG:
 				last_parsed_option = ARG_SERVER_VERBOSE;
@@ -125,7 +235,11 @@ bool argparse_server_parse(int argc, char **argv, argparse_server_callback_t arg
 }
 
 void argparse_server_show_syntax(void) {
-	fprintf(stderr, "usage: luksrku server [-p port] [-s] [-v] filename\n");
+	fprintf(stderr, "usage: luksrku server [-p port] [-s] [-e {epoll,pool,threads}] [-t count] [-q count] [-a count]\n");
+	fprintf(stderr, "                      [-b count] [--vault-shards count] [--kdf-lanes count]\n");
+	fprintf(stderr, "                      [--coalesce-window millis] [--coalesce-max-batch count] [--warm-up-ttl millis]\n");
+	fprintf(stderr, "                      [-v]\n");
+	fprintf(stderr, "                      filename\n");
 	fprintf(stderr, "\n");
 	fprintf(stderr, "Starts a luksrku key server.\n");
 	fprintf(stderr, "\n");
@@ -136,6 +250,54 @@ void argparse_server_show_syntax(void) {
 	fprintf(stderr, "  -p port, --port port  Port that is used for both UDP and TCP communication. Defaults to 23170.\n");
 	fprintf(stderr, "  -s, --silent          Do not answer UDP queries for clients trying to find a key server, only\n");
 	fprintf(stderr, "                        serve key database using TCP.\n");
+	fprintf(stderr, "  -e {epoll,pool,threads}, --engine {epoll,pool,threads}\n");
+	fprintf(stderr, "                        Connection handling engine to use. \"epoll\" drives all TLS handshakes non-\n");
+	fprintf(stderr, "                        blocking from a small number of event loop threads, \"pool\" hands connections\n");
+	fprintf(stderr, "                        to a fixed-size pool of worker threads through a bounded queue and rejects\n");
+	fprintf(stderr, "                        clients when that queue is full, \"threads\" creates one thread per connecting\n");
+	fprintf(stderr, "                        client. Defaults to epoll.\n");
+	fprintf(stderr, "  -t count, --threads count\n");
+	fprintf(stderr, "                        Number of event loop threads (epoll engine) or worker threads (pool engine)\n");
+	fprintf(stderr, "                        to use. Defaults to the number of online CPUs.\n");
+	fprintf(stderr, "  -q count, --queue-depth count\n");
+	fprintf(stderr, "                        Number of accepted connections that may wait for a worker thread when using\n");
+	fprintf(stderr, "                        the pool engine. Connections exceeding this are closed immediately. With the\n");
+	fprintf(stderr, "                        epoll engine, this is the number of handshakes that may wait for a vault\n");
+	fprintf(stderr, "                        worker thread; beyond that, the event loop opens the vault itself. Defaults\n");
+	fprintf(stderr, "                        to 256.\n");
+	fprintf(stderr, "  -a count, --acceptors count\n");
+	fprintf(stderr, "                        Number of TCP listening sockets to open. When more than one is used, all are\n");
+	fprintf(stderr, "                        bound to the same port using SO_REUSEPORT and the kernel distributes\n");
+	fprintf(stderr, "                        incoming connections among them; each is served by its own accept loop. A\n");
+	fprintf(stderr, "                        value of 0 opens one listening socket per online CPU. Defaults to 1.\n");
+	fprintf(stderr, "  -b count, --backlog count\n");
+	fprintf(stderr, "                        Length of the pending connection backlog of each TCP listening socket.\n");
+	fprintf(stderr, "                        Defaults to 128.\n");
+	fprintf(stderr, "  --vault-shards count  Number of separately encrypted in-memory vaults the key database is split\n");
+	fprintf(stderr, "                        into. Hosts in different shards can be served concurrently and opening a\n");
+	fprintf(stderr, "                        shard only decrypts the keys of its hosts, but every shard keeps 2 MiB of\n");
+	fprintf(stderr, "                        pre-key material in memory and costs one key derivation at startup. A value\n");
+	fprintf(stderr, "                        of 0 uses one shard per host. At most 64 shards are created, i.e., 128 MiB.\n");
+	fprintf(stderr, "                        Defaults to 16.\n");
+	fprintf(stderr, "  --kdf-lanes count     Number of parallel lanes the in-memory vault key derivation is split into.\n");
+	fprintf(stderr, "                        The total work factor of the derivation stays the same, but it is spread\n");
+	fprintf(stderr, "                        across multiple CPU cores, reducing unlock latency. At most 16 lanes are\n");
+	fprintf(stderr, "                        used. Defaults to the number of online CPUs.\n");
+	fprintf(stderr, "  --coalesce-window millis\n");
+	fprintf(stderr, "                        Keep a vault shard decrypted for this many milliseconds after the last\n");
+	fprintf(stderr, "                        client is served, so that clients arriving in close succession are served\n");
+	fprintf(stderr, "                        from the same decryption. This trades a slightly longer exposure of the keys\n");
+	fprintf(stderr, "                        in memory for less key derivation work during boot storms. Defaults to 0,\n");
+	fprintf(stderr, "                        which seals vaults immediately.\n");
+	fprintf(stderr, "  --coalesce-max-batch count\n");
+	fprintf(stderr, "                        Maximum number of clients that are served from one vault decryption when\n");
+	fprintf(stderr, "                        coalescing is enabled. Defaults to 64.\n");
+	fprintf(stderr, "  --warm-up-ttl millis  When a known host announces itself via UDP discovery, start decrypting its\n");
+	fprintf(stderr, "                        vault shard right away and keep it decrypted for this many milliseconds, so\n");
+	fprintf(stderr, "                        that the subsequent connection does not have to wait for the key derivation.\n");
+	fprintf(stderr, "                        Only has an effect when UDP queries are answered. Since discovery is\n");
+	fprintf(stderr, "                        unauthenticated, this lets anyone who knows a host UUID keep its shard\n");
+	fprintf(stderr, "                        decrypted. Defaults to 0, which disables warm-up.\n");
 	fprintf(stderr, "  -v, --verbose         Increase verbosity. Can be specified multiple times.\n");
 }
 
@@ -163,6 +325,16 @@ static const char *option_enum_to_str(enum argparse_server_option_t option) {
 	switch (option) {
 		case ARG_SERVER_PORT: return "ARG_SERVER_PORT";
 		case ARG_SERVER_SILENT: return "ARG_SERVER_SILENT";
+		case ARG_SERVER_ENGINE: return "ARG_SERVER_ENGINE";
+		case ARG_SERVER_THREADS: return "ARG_SERVER_THREADS";
+		case ARG_SERVER_QUEUE_DEPTH: return "ARG_SERVER_QUEUE_DEPTH";
+		case ARG_SERVER_ACCEPTORS: return "ARG_SERVER_ACCEPTORS";
+		case ARG_SERVER_BACKLOG: return "ARG_SERVER_BACKLOG";
+		case ARG_SERVER_VAULT_SHARDS: return "ARG_SERVER_VAULT_SHARDS";
+		case ARG_SERVER_KDF_LANES: return "ARG_SERVER_KDF_LANES";
+		case ARG_SERVER_COALESCE_WINDOW: return "ARG_SERVER_COALESCE_WINDOW";
+		case ARG_SERVER_COALESCE_MAX_BATCH: return "ARG_SERVER_COALESCE_MAX_BATCH";
+		case ARG_SERVER_WARM_UP_TTL: return "ARG_SERVER_WARM_UP_TTL";
 		case ARG_SERVER_VERBOSE: return "ARG_SERVER_VERBOSE";
 		case ARG_SERVER_FILENAME: return "ARG_SERVER_FILENAME";
 	}
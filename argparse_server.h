@@ -5,7 +5,7 @@
  *
  *   Do not edit it by hand, your changes will be overwritten.
  *
- *   Generated at: 2021-06-27 13:24:40
+ *   Generated at: 2026-10-17 20:04:51
  */
 
 #ifndef __ARGPARSE_SERVER_H__
@@ -14,6 +14,16 @@
 #include <stdbool.h>
 
 #define ARGPARSE_SERVER_DEFAULT_PORT		23170
+#define ARGPARSE_SERVER_DEFAULT_ENGINE		"epoll"
+#define ARGPARSE_SERVER_DEFAULT_THREADS		0
+#define ARGPARSE_SERVER_DEFAULT_QUEUE_DEPTH		256
+#define ARGPARSE_SERVER_DEFAULT_ACCEPTORS		1
+#define ARGPARSE_SERVER_DEFAULT_BACKLOG		128
+#define ARGPARSE_SERVER_DEFAULT_VAULT_SHARDS		16
+#define ARGPARSE_SERVER_DEFAULT_KDF_LANES		0
+#define ARGPARSE_SERVER_DEFAULT_COALESCE_WINDOW		0
+#define ARGPARSE_SERVER_DEFAULT_COALESCE_MAX_BATCH		64
+#define ARGPARSE_SERVER_DEFAULT_WARM_UP_TTL		0
 #define ARGPARSE_SERVER_DEFAULT_VERBOSE		0
 
 #define ARGPARSE_SERVER_NO_OPTION		0
@@ -22,8 +32,18 @@
 enum argparse_server_option_t {
 	ARG_SERVER_PORT = 2,
 	ARG_SERVER_SILENT = 3,
-	ARG_SERVER_VERBOSE = 4,
-	ARG_SERVER_FILENAME = 5,
+	ARG_SERVER_ENGINE = 4,
+	ARG_SERVER_THREADS = 5,
+	ARG_SERVER_QUEUE_DEPTH = 6,
+	ARG_SERVER_ACCEPTORS = 7,
+	ARG_SERVER_BACKLOG = 8,
+	ARG_SERVER_VAULT_SHARDS = 9,
+	ARG_SERVER_KDF_LANES = 10,
+	ARG_SERVER_COALESCE_WINDOW = 11,
+	ARG_SERVER_COALESCE_MAX_BATCH = 12,
+	ARG_SERVER_WARM_UP_TTL = 13,
+	ARG_SERVER_VERBOSE = 14,
+	ARG_SERVER_FILENAME = 15,
 };
 
 typedef void (*argparse_server_errmsg_callback_t)(const char *errmsg, ...);
@@ -21,34 +21,252 @@
 	Johannes Bauer <JohannesBauer@gmx.de>
 */
 
+
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include "blacklist.h"
 #include "global.h"
 #include "util.h"
+#include "log.h"
+
+static unsigned int blacklist_hash(const struct ip_address_t *ip) {
+	/* All IPv4 addresses share the same v4-mapped prefix, so mix all bits */
+	uint64_t lo, hi;
+	memcpy(&lo, ip->bytes + 0, sizeof(lo));
+	memcpy(&hi, ip->bytes + 8, sizeof(hi));
+	uint64_t hash = lo ^ (hi * 0x9e3779b97f4a7c15ULL) ^ ((uint64_t)ip->scope_id << 32);
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdULL;
+	hash ^= hash >> 33;
+	hash *= 0xc4ceb9fe1a85ec53ULL;
+	hash ^= hash >> 33;
+	return hash;
+}
+
+static uint32_t *blacklist_bucket(struct blacklist_t *blacklist, const struct ip_address_t *ip) {
+	return &blacklist->buckets[blacklist_hash(ip) & blacklist->bucket_mask];
+}
+
+/* Every wheel slot is a circular list that starts with its oldest entry, new
+ * entries are appended at the end */
+static void blacklist_wheel_link(struct blacklist_t *blacklist, uint32_t index) {
+	struct blacklist_entry_t *entry = &blacklist->entries[index];
+	uint32_t *slot = &blacklist->wheel[entry->expiry_tick % BLACKLIST_WHEEL_SLOTS];
+	if (*slot == BLACKLIST_NO_ENTRY) {
+		entry->wheel_prev = index;
+		entry->wheel_next = index;
+		*slot = index;
+	} else {
+		const uint32_t head = *slot;
+		const uint32_t tail = blacklist->entries[head].wheel_prev;
+		entry->wheel_prev = tail;
+		entry->wheel_next = head;
+		blacklist->entries[tail].wheel_next = index;
+		blacklist->entries[head].wheel_prev = index;
+	}
+}
+
+static void blacklist_wheel_unlink(struct blacklist_t *blacklist, uint32_t index) {
+	struct blacklist_entry_t *entry = &blacklist->entries[index];
+	uint32_t *slot = &blacklist->wheel[entry->expiry_tick % BLACKLIST_WHEEL_SLOTS];
+	if (entry->wheel_next == index) {
+		*slot = BLACKLIST_NO_ENTRY;
+		return;
+	}
+	blacklist->entries[entry->wheel_prev].wheel_next = entry->wheel_next;
+	blacklist->entries[entry->wheel_next].wheel_prev = entry->wheel_prev;
+	if (*slot == index) {
+		*slot = entry->wheel_next;
+	}
+}
 
-static struct blacklist_entry_t blacklist[BLACKLIST_ENTRY_COUNT];
+static void blacklist_remove(struct blacklist_t *blacklist, uint32_t index) {
+	struct blacklist_entry_t *entry = &blacklist->entries[index];
+	uint32_t *link = blacklist_bucket(blacklist, &entry->ip);
+	while (*link != index) {
+		link = &blacklist->entries[*link].hash_next;
+	}
+	*link = entry->hash_next;
+	blacklist_wheel_unlink(blacklist, index);
+	entry->hash_next = blacklist->free_head;
+	blacklist->free_head = index;
+}
+
+/* Reclaims the entries in all wheel slots whose tick has passed since the
+ * last call. Visits every slot at most once, no matter how long ago that
+ * was. */
+static void blacklist_expire(struct blacklist_t *blacklist, uint64_t current_tick) {
+	uint64_t tick_count = current_tick - blacklist->wheel_tick;
+	if (tick_count > BLACKLIST_WHEEL_SLOTS) {
+		tick_count = BLACKLIST_WHEEL_SLOTS;
+	}
+	for (uint64_t tick = current_tick - tick_count + 1; tick <= current_tick; tick++) {
+		uint32_t index = blacklist->wheel[tick % BLACKLIST_WHEEL_SLOTS];
+		if (index == BLACKLIST_NO_ENTRY) {
+			continue;
+		}
+
+		/* Entries with timeouts longer than the wheel spans stay for
+		 * another round */
+		const uint32_t tail = blacklist->entries[index].wheel_prev;
+		while (true) {
+			const uint32_t next = blacklist->entries[index].wheel_next;
+			const bool is_tail = (index == tail);
+			if (blacklist->entries[index].expiry_tick <= current_tick) {
+				blacklist_remove(blacklist, index);
+			}
+			if (is_tail) {
+				break;
+			}
+			index = next;
+		}
+	}
+	blacklist->wheel_tick = current_tick;
+}
 
-static bool blacklist_entry_expired(int index) {
-	return now() > blacklist[index].timeout;
+static uint32_t blacklist_find(struct blacklist_t *blacklist, const struct ip_address_t *ip) {
+	for (uint32_t index = *blacklist_bucket(blacklist, ip); index != BLACKLIST_NO_ENTRY; index = blacklist->entries[index].hash_next) {
+		if (ip_address_equal(ip, &blacklist->entries[index].ip)) {
+			return index;
+		}
+	}
+	return BLACKLIST_NO_ENTRY;
 }
 
-void blacklist_ip(uint32_t ip, unsigned int timeout_seconds) {
-	for (int i = 0; i < BLACKLIST_ENTRY_COUNT; i++) {
-		if (blacklist_entry_expired(i)) {
-			blacklist[i].ip = ip;
-			blacklist[i].timeout = now() + timeout_seconds;
+/* Makes room when the table is full by dropping the oldest entry of the
+ * wheel slot that is up next for expiry */
+static void blacklist_evict(struct blacklist_t *blacklist) {
+	for (unsigned int i = 1; i <= BLACKLIST_WHEEL_SLOTS; i++) {
+		const uint32_t index = blacklist->wheel[(blacklist->wheel_tick + i) % BLACKLIST_WHEEL_SLOTS];
+		if (index != BLACKLIST_NO_ENTRY) {
+			blacklist_remove(blacklist, index);
+			blacklist->eviction_count++;
+			if (blacklist->eviction_count == 1) {
+				log_msg(LLVL_WARNING, "Blacklist of %u addresses is full, evicting entries before they expire.", blacklist->capacity);
+			}
 			return;
 		}
 	}
 }
 
-bool is_ip_blacklisted(uint32_t ip) {
-	for (int i = 0; i < BLACKLIST_ENTRY_COUNT; i++) {
-		if ((ip == blacklist[i].ip) && (!blacklist_entry_expired(i))) {
-			return true;
+/* Sets the timeout of an existing entry or, if index is BLACKLIST_NO_ENTRY,
+ * of a newly created one. */
+static void blacklist_set(struct blacklist_t *blacklist, uint32_t index, const struct ip_address_t *ip, double current_time, unsigned int timeout_seconds) {
+	if (index == BLACKLIST_NO_ENTRY) {
+		if (blacklist->free_head == BLACKLIST_NO_ENTRY) {
+			blacklist_evict(blacklist);
 		}
+		index = blacklist->free_head;
+		struct blacklist_entry_t *entry = &blacklist->entries[index];
+		blacklist->free_head = entry->hash_next;
+		entry->ip = *ip;
+		uint32_t *bucket = blacklist_bucket(blacklist, ip);
+		entry->hash_next = *bucket;
+		*bucket = index;
+	} else {
+		blacklist_wheel_unlink(blacklist, index);
+	}
+
+	struct blacklist_entry_t *entry = &blacklist->entries[index];
+	entry->timeout = current_time + timeout_seconds;
+	entry->expiry_tick = (uint64_t)entry->timeout + 1;
+	blacklist_wheel_link(blacklist, index);
+}
+
+static bool blacklist_is_listed(struct blacklist_t *blacklist, uint32_t index, double current_time) {
+	/* Entries are only reclaimed at full seconds, so check the exact
+	 * timeout as well */
+	return (index != BLACKLIST_NO_ENTRY) && (blacklist->entries[index].timeout > current_time);
+}
+
+/* The capacity should cover all addresses expected within one timeout
+ * period, e.g., all hosts of the fleet. */
+struct blacklist_t *blacklist_new(unsigned int capacity) {
+	if (capacity < BLACKLIST_MIN_CAPACITY) {
+		capacity = BLACKLIST_MIN_CAPACITY;
+	}
+	unsigned int bucket_count = BLACKLIST_MIN_CAPACITY;
+	while (bucket_count < capacity) {
+		bucket_count *= 2;
+	}
+
+	struct blacklist_t *blacklist = calloc(1, sizeof(struct blacklist_t));
+	if (!blacklist) {
+		log_libc(LLVL_ERROR, "Unable to calloc(3) blacklist");
+		return NULL;
+	}
+	if (pthread_mutex_init(&blacklist->mutex, NULL)) {
+		log_libc(LLVL_ERROR, "Unable to initialize blacklist mutex.");
+		free(blacklist);
+		return NULL;
+	}
+	blacklist->capacity = capacity;
+	blacklist->bucket_mask = bucket_count - 1;
+	blacklist->buckets = malloc(sizeof(uint32_t) * bucket_count);
+	blacklist->entries = malloc(sizeof(struct blacklist_entry_t) * capacity);
+	if (!blacklist->buckets || !blacklist->entries) {
+		log_libc(LLVL_ERROR, "Unable to malloc(3) blacklist of %u entries", capacity);
+		blacklist_free(blacklist);
+		return NULL;
+	}
+
+	for (unsigned int i = 0; i < bucket_count; i++) {
+		blacklist->buckets[i] = BLACKLIST_NO_ENTRY;
+	}
+	for (unsigned int i = 0; i < BLACKLIST_WHEEL_SLOTS; i++) {
+		blacklist->wheel[i] = BLACKLIST_NO_ENTRY;
+	}
+	for (unsigned int i = 0; i < capacity; i++) {
+		blacklist->entries[i].hash_next = (i + 1 < capacity) ? (i + 1) : BLACKLIST_NO_ENTRY;
+	}
+	blacklist->free_head = 0;
+	blacklist->wheel_tick = (uint64_t)monotonic_now();
+	log_msg(LLVL_DEBUG, "Created blacklist for %u addresses with %u buckets.", capacity, bucket_count);
+	return blacklist;
+}
+
+void blacklist_ip(struct blacklist_t *blacklist, const struct ip_address_t *ip, unsigned int timeout_seconds) {
+	pthread_mutex_lock(&blacklist->mutex);
+	const double current_time = monotonic_now();
+	blacklist_expire(blacklist, (uint64_t)current_time);
+	blacklist_set(blacklist, blacklist_find(blacklist, ip), ip, current_time, timeout_seconds);
+	pthread_mutex_unlock(&blacklist->mutex);
+}
+
+bool is_ip_blacklisted(struct blacklist_t *blacklist, const struct ip_address_t *ip) {
+	pthread_mutex_lock(&blacklist->mutex);
+	const double current_time = monotonic_now();
+	blacklist_expire(blacklist, (uint64_t)current_time);
+	const bool listed = blacklist_is_listed(blacklist, blacklist_find(blacklist, ip), current_time);
+	pthread_mutex_unlock(&blacklist->mutex);
+	return listed;
+}
+
+/* Checks and blacklists an address in one step, so that of several threads
+ * seeing the same address only one gets to handle it. Returns true if the
+ * address was not blacklisted before. */
+bool blacklist_ip_unless_listed(struct blacklist_t *blacklist, const struct ip_address_t *ip, unsigned int timeout_seconds) {
+	pthread_mutex_lock(&blacklist->mutex);
+	const double current_time = monotonic_now();
+	blacklist_expire(blacklist, (uint64_t)current_time);
+	const uint32_t index = blacklist_find(blacklist, ip);
+	const bool listed = blacklist_is_listed(blacklist, index, current_time);
+	if (!listed) {
+		blacklist_set(blacklist, index, ip, current_time, timeout_seconds);
+	}
+	pthread_mutex_unlock(&blacklist->mutex);
+	return !listed;
+}
+
+void blacklist_free(struct blacklist_t *blacklist) {
+	if (!blacklist) {
+		return;
 	}
-	return false;
+	pthread_mutex_destroy(&blacklist->mutex);
+	free(blacklist->buckets);
+	free(blacklist->entries);
+	free(blacklist);
 }
@@ -21,22 +21,58 @@
 	Johannes Bauer <JohannesBauer@gmx.de>
 */
 
+
 #ifndef __BLACKLIST_H__
 #define __BLACKLIST_H__
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <pthread.h>
+#include "ipaddr.h"
+
+/* Entries are reclaimed by a timing wheel with a granularity of one second.
+ * Longer timeouts than the wheel spans work, they just take several rounds. */
+#define BLACKLIST_WHEEL_SLOTS								64
+
+/* Smallest number of addresses that a blacklist can hold */
+#define BLACKLIST_MIN_CAPACITY								64
 
-#define BLACKLIST_ENTRY_COUNT								32
+#define BLACKLIST_NO_ENTRY									UINT32_MAX
 
 struct blacklist_entry_t {
-	uint32_t ip;
+	struct ip_address_t ip;
+	/* Monotonic time at which the entry expires */
 	double timeout;
+	/* The wheel tick at which the entry is reclaimed */
+	uint64_t expiry_tick;
+	/* Next entry in the same hash bucket, or in the free list */
+	uint32_t hash_next;
+	uint32_t wheel_prev;
+	uint32_t wheel_next;
+};
+
+/* A fixed-capacity hash table of blacklisted addresses. Every operation does
+ * a bounded amount of work under one mutex and reads the clock only once.
+ * When the table is full, the entry that would expire next is evicted. */
+struct blacklist_t {
+	pthread_mutex_t mutex;
+	unsigned int capacity;
+	unsigned int bucket_mask;
+	uint32_t *buckets;
+	struct blacklist_entry_t *entries;
+	uint32_t free_head;
+	uint32_t wheel[BLACKLIST_WHEEL_SLOTS];
+	/* Last tick up to which expired entries have been reclaimed */
+	uint64_t wheel_tick;
+	uint64_t eviction_count;
 };
 
 /*************** AUTO GENERATED SECTION FOLLOWS ***************/
-void blacklist_ip(uint32_t ip, unsigned int timeout_seconds);
-bool is_ip_blacklisted(uint32_t ip);
+struct blacklist_t *blacklist_new(unsigned int capacity);
+void blacklist_ip(struct blacklist_t *blacklist, const struct ip_address_t *ip, unsigned int timeout_seconds);
+bool is_ip_blacklisted(struct blacklist_t *blacklist, const struct ip_address_t *ip);
+bool blacklist_ip_unless_listed(struct blacklist_t *blacklist, const struct ip_address_t *ip, unsigned int timeout_seconds);
+void blacklist_free(struct blacklist_t *blacklist);
 /***************  AUTO GENERATED SECTION ENDS   ***************/
 
 #endif
@@ -32,6 +32,8 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netdb.h>
+#include <pthread.h>
+#include <time.h>
 
 
 #include "log.h"
@@ -39,11 +41,13 @@
 #include "util.h"
 #include "msg.h"
 #include "client.h"
-#include "blacklist.h"
+#include "keyserver_health.h"
+#include "ipaddr.h"
 #include "keydb.h"
 #include "uuid.h"
 #include "udp.h"
 #include "luks.h"
+#include "connection_race.h"
 
 struct keyclient_t {
 	const struct pgmopts_client_t *opts;
@@ -51,6 +55,8 @@ struct keyclient_t {
 	bool volume_unlocked[MAX_VOLUMES_PER_HOST];
 	unsigned char identifier[ASCII_UUID_BUFSIZE];
 	double broadcast_start_time;
+	struct generic_tls_ctx_t gctx;
+	struct keyserver_health_t keyserver_health;
 };
 
 static int psk_client_callback(SSL *ssl, const EVP_MD *md, const unsigned char **id, size_t *idlen, SSL_SESSION **sessptr) {
@@ -61,11 +67,21 @@ static int psk_client_callback(SSL *ssl, const EVP_MD *md, const unsigned char *
 	return openssl_tls13_psk_establish_session(ssl, key_client->keydb->hosts[0].tls_psk, PSK_SIZE_BYTES, EVP_sha256(), sessptr);
 }
 
-static bool unlock_luks_volume(const volume_entry_t *volume, const struct msg_t *unlock_msg) {
+static bool unlock_luks_volume(const volume_entry_t *volume, const struct msg_volume_key_t *unlock_vk_msg) {
+	const struct msg_t *unlock_msg = &unlock_vk_msg->msg;
+	bool allow_discards = volume->volume_flags & VOLUME_FLAG_ALLOW_DISCARDS;
+
+	if (unlock_vk_msg->luks_volume_key_length) {
+		/* Activating by volume key skips the keyslot KDF entirely */
+		if (open_luks_device_by_volume_key(volume->volume_uuid, volume->devmapper_name, unlock_vk_msg->luks_volume_key, unlock_vk_msg->luks_volume_key_length, allow_discards)) {
+			return true;
+		}
+		log_msg(LLVL_WARNING, "Unlocking of volume %s with server-provided volume key failed, falling back to passphrase.", volume->devmapper_name);
+	}
+
 	bool success = true;
 	char luks_passphrase[LUKS_PASSPHRASE_TEXT_SIZE_BYTES];
 	if (ascii_encode(luks_passphrase, sizeof(luks_passphrase), unlock_msg->luks_passphrase_raw, sizeof(unlock_msg->luks_passphrase_raw))) {
-		bool allow_discards = volume->volume_flags & VOLUME_FLAG_ALLOW_DISCARDS;
 		success = open_luks_device(volume->volume_uuid, volume->devmapper_name, luks_passphrase, strlen(luks_passphrase), allow_discards);
 	} else {
 		log_msg(LLVL_FATAL, "Failed to transcribe raw LUKS passphrase to text form.");
@@ -75,154 +91,335 @@ static bool unlock_luks_volume(const volume_entry_t *volume, const struct msg_t
 	return success;
 }
 
-static bool attempt_unlock_luks_volume(struct keyclient_t *keyclient, const struct msg_t *unlock_msg) {
-	const host_entry_t *host = &keyclient->keydb->hosts[0];
-	const volume_entry_t* volume = keydb_get_volume_by_uuid(host, unlock_msg->volume_uuid);
-	char volume_uuid_str[ASCII_UUID_BUFSIZE];
-	sprintf_uuid(volume_uuid_str, unlock_msg->volume_uuid);
-	if (!volume) {
-		log_msg(LLVL_WARNING, "Keyserver provided key for unlocking volume UUID %s, but this volume is not known on the client side.", volume_uuid_str);
-		return false;
+struct unlock_job_t {
+	const volume_entry_t *volume;
+	int volume_index;
+	const struct msg_volume_key_t *msg;
+	bool success;
+};
+
+struct unlock_worker_ctx_t {
+	pthread_mutex_t lock;
+	struct unlock_job_t *jobs;
+	unsigned int job_count;
+	unsigned int next_job;
+};
+
+static void* unlock_worker_thread(void *vctx) {
+	struct unlock_worker_ctx_t *ctx = (struct unlock_worker_ctx_t*)vctx;
+	while (true) {
+		pthread_mutex_lock(&ctx->lock);
+		struct unlock_job_t *job = (ctx->next_job < ctx->job_count) ? &ctx->jobs[ctx->next_job++] : NULL;
+		pthread_mutex_unlock(&ctx->lock);
+		if (!job) {
+			break;
+		}
+		job->success = unlock_luks_volume(job->volume, job->msg);
+	}
+	return NULL;
+}
+
+static void run_unlock_jobs(struct keyclient_t *keyclient, struct unlock_job_t *jobs, unsigned int job_count) {
+	struct unlock_worker_ctx_t ctx = {
+		.jobs = jobs,
+		.job_count = job_count,
+	};
+	if (pthread_mutex_init(&ctx.lock, NULL)) {
+		log_libc(LLVL_ERROR, "Unable to initialize unlock worker mutex, unlocking sequentially.");
+		for (unsigned int i = 0; i < job_count; i++) {
+			jobs[i].success = unlock_luks_volume(jobs[i].volume, jobs[i].msg);
+		}
+		return;
+	}
+
+	unsigned int worker_count = keyclient->opts->parallel_unlocks;
+	if (worker_count > job_count) {
+		worker_count = job_count;
+	}
+	log_msg(LLVL_DEBUG, "Unlocking %u volume(s) using %u parallel worker(s).", job_count, worker_count);
+
+	pthread_t workers[worker_count];
+	unsigned int workers_started = 0;
+	for (unsigned int i = 0; i < worker_count; i++) {
+		if (pthread_create(&workers[i], NULL, unlock_worker_thread, &ctx)) {
+			log_libc(LLVL_ERROR, "Unable to pthread_create(3) unlock worker %u", i);
+			break;
+		}
+		workers_started++;
+	}
+	if (workers_started == 0) {
+		/* Do the work ourselves then */
+		unlock_worker_thread(&ctx);
 	}
+	for (unsigned int i = 0; i < workers_started; i++) {
+		pthread_join(workers[i], NULL);
+	}
+	pthread_mutex_destroy(&ctx.lock);
+}
+
+static void unlock_luks_volumes(struct keyclient_t *keyclient, const struct msg_volume_key_t *msgs, unsigned int msg_count) {
+	const host_entry_t *host = &keyclient->keydb->hosts[0];
+	struct unlock_job_t jobs[MAX_VOLUMES_PER_HOST];
+	bool volume_scheduled[MAX_VOLUMES_PER_HOST] = { 0 };
+	unsigned int job_count = 0;
+
+	/* First determine which of the received keys actually need a luksOpen */
+	for (unsigned int i = 0; i < msg_count; i++) {
+		const struct msg_t *unlock_msg = &msgs[i].msg;
+		char volume_uuid_str[ASCII_UUID_BUFSIZE];
+		sprintf_uuid(volume_uuid_str, unlock_msg->volume_uuid);
+		log_msg(LLVL_TRACE, "Received LUKS key to unlock volume with UUID %s", volume_uuid_str);
+
+		const volume_entry_t* volume = keydb_get_volume_by_uuid(host, unlock_msg->volume_uuid);
+		if (!volume) {
+			log_msg(LLVL_WARNING, "Keyserver provided key for unlocking volume UUID %s, but this volume is not known on the client side.", volume_uuid_str);
+			log_msg(LLVL_ERROR, "Failed to unlocked volume with UUID %s", volume_uuid_str);
+			continue;
+		}
+
+		int volume_index = keydb_get_volume_index(host, volume);
+		if (volume_index == -1) {
+			log_msg(LLVL_FATAL, "Error calculating volume offset for volume %p from base %p.", volume, host->volumes);
+			log_msg(LLVL_ERROR, "Failed to unlocked volume with UUID %s", volume_uuid_str);
+			continue;
+		}
 
-	/* This is a valid volume which we need to unlock */
-	int volume_index = keydb_get_volume_index(host, volume);
-	if (volume_index != -1) {
 		if (keyclient->opts->no_luks) {
 			keyclient->volume_unlocked[volume_index] = true;
 #ifdef DEBUG
 			dump_hexline(stderr, "Raw key: ", unlock_msg->luks_passphrase_raw, LUKS_PASSPHRASE_RAW_SIZE_BYTES, false);
 #endif
+			log_msg(LLVL_DEBUG, "Successfully unlocked volume with UUID %s", volume_uuid_str);
+		} else if (keyclient->volume_unlocked[volume_index] || volume_scheduled[volume_index]) {
+			log_msg(LLVL_WARNING, "Volume %s / %s already unlocked, not attemping to unlock again.", volume->devmapper_name, volume_uuid_str);
 		} else {
-			if (!keyclient->volume_unlocked[volume_index]) {
-				bool success = unlock_luks_volume(volume, unlock_msg);
-				keyclient->volume_unlocked[volume_index] = success;
-				if (!success) {
-					log_msg(LLVL_ERROR, "Unlocking of volume %s / %s failed with the server-provided passphrase.", volume->devmapper_name, volume_uuid_str);
-					return false;
-				}
-			} else {
-				log_msg(LLVL_WARNING, "Volume %s / %s already unlocked, not attemping to unlock again.", volume->devmapper_name, volume_uuid_str);
-			}
+			volume_scheduled[volume_index] = true;
+			jobs[job_count++] = (struct unlock_job_t){
+				.volume = volume,
+				.volume_index = volume_index,
+				.msg = &msgs[i],
+			};
 		}
-	} else {
-		log_msg(LLVL_FATAL, "Error calculating volume offset for volume %p from base %p.", volume, host->volumes);
-		return false;
 	}
 
-	return true;
+	if (job_count == 0) {
+		return;
+	}
+
+	/* Each cryptsetup invocation is dominated by the key derivation, so run
+	 * them concurrently */
+	run_unlock_jobs(keyclient, jobs, job_count);
+
+	for (unsigned int i = 0; i < job_count; i++) {
+		const struct unlock_job_t *job = &jobs[i];
+		char volume_uuid_str[ASCII_UUID_BUFSIZE];
+		sprintf_uuid(volume_uuid_str, job->volume->volume_uuid);
+		keyclient->volume_unlocked[job->volume_index] = job->success;
+		if (job->success) {
+			log_msg(LLVL_DEBUG, "Successfully unlocked volume with UUID %s", volume_uuid_str);
+		} else {
+			log_msg(LLVL_ERROR, "Unlocking of volume %s / %s failed with the server-provided passphrase.", job->volume->devmapper_name, volume_uuid_str);
+		}
+	}
 }
 
-static bool contact_keyserver_socket(struct keyclient_t *keyclient, int sd) {
-	struct generic_tls_ctx_t gctx;
-	if (!create_generic_tls_context(&gctx, false)) {
+static bool create_client_tls_context(struct keyclient_t *keyclient) {
+	if (!create_generic_tls_context(&keyclient->gctx, false)) {
 		log_msg(LLVL_FATAL, "Failed to create OpenSSL client context.");
 		return false;
 	}
-	SSL_CTX_set_psk_use_session_callback(gctx.ctx, psk_client_callback);
+	SSL_CTX_set_psk_use_session_callback(keyclient->gctx.ctx, psk_client_callback);
+
+	/* Offer volume key delivery, ALPN wire format is length-prefixed */
+	unsigned char alpn_protocols[1 + sizeof(MSG_ALPN_VOLUME_KEY) - 1];
+	alpn_protocols[0] = sizeof(MSG_ALPN_VOLUME_KEY) - 1;
+	memcpy(alpn_protocols + 1, MSG_ALPN_VOLUME_KEY, sizeof(MSG_ALPN_VOLUME_KEY) - 1);
+	if (SSL_CTX_set_alpn_protos(keyclient->gctx.ctx, alpn_protocols, sizeof(alpn_protocols))) {
+		log_openssl(LLVL_WARNING, "Unable to offer volume key delivery via ALPN");
+	}
+	return true;
+}
 
-	SSL *ssl = SSL_new(gctx.ctx);
-	if (ssl) {
-		SSL_set_fd(ssl, sd);
-		SSL_set_app_data(ssl, keyclient);
-
-		if (SSL_connect(ssl) == 1) {
-			struct msg_t msg;
-			while (true) {
-				int bytes_read = SSL_read(ssl, &msg, sizeof(msg));
-				if (bytes_read == 0) {
-					/* Server closed the connection. */
-					break;
-				}
-				if (bytes_read != sizeof(msg)) {
-					log_openssl(LLVL_FATAL, "SSL_read returned %d bytes when we expected to read %d", bytes_read, sizeof(msg));
-					break;
-				}
-				char uuid_str[ASCII_UUID_BUFSIZE];
-				sprintf_uuid(uuid_str, msg.volume_uuid);
-				log_msg(LLVL_TRACE, "Received LUKS key to unlock volume with UUID %s", uuid_str);
-				if (attempt_unlock_luks_volume(keyclient, &msg)) {
-					log_msg(LLVL_DEBUG, "Successfully unlocked volume with UUID %s", uuid_str);
-				} else {
-					log_msg(LLVL_ERROR, "Failed to unlocked volume with UUID %s", uuid_str);
-				}
+/* A zero return without close_notify is how our own keyserver ends the
+ * stream; resets, timeouts and truncated messages are not a clean close. */
+static bool ssl_read_closed_cleanly(SSL *ssl, int bytes_read) {
+	return (bytes_read == 0) || (SSL_get_error(ssl, bytes_read) == SSL_ERROR_ZERO_RETURN);
+}
+
+/* Returns the number of volume keys the server sent. clean_close is set if
+ * the server ended the stream orderly instead of it being cut off. */
+static unsigned int receive_and_unlock_volumes(struct keyclient_t *keyclient, SSL *ssl, bool *clean_close) {
+	/* Receive all keys first so that the volumes can be unlocked
+	 * concurrently once the server is done */
+	struct msg_volume_key_t msgs[MAX_VOLUMES_PER_HOST] = { 0 };
+	unsigned int msg_count = 0;
+
+	/* Servers which do not support volume key delivery send plain messages
+	 * only */
+	const bool volume_key_delivery = openssl_alpn_negotiated(ssl, MSG_ALPN_VOLUME_KEY);
+	const int msg_size = volume_key_delivery ? sizeof(struct msg_volume_key_t) : sizeof(struct msg_t);
+	*clean_close = false;
+	while (true) {
+		if (msg_count == MAX_VOLUMES_PER_HOST) {
+			/* A host may legitimately have all slots in use, only complain
+			 * if the server actually sends anything beyond that */
+			struct msg_volume_key_t excess_msg;
+			int bytes_read = SSL_read(ssl, volume_key_delivery ? (void*)&excess_msg : (void*)&excess_msg.msg, msg_size);
+			OPENSSL_cleanse(&excess_msg, sizeof(excess_msg));
+			if (bytes_read > 0) {
+				log_msg(LLVL_WARNING, "Keyserver sent more than %d keys, ignoring the remainder.", MAX_VOLUMES_PER_HOST);
+				*clean_close = true;
+			} else {
+				*clean_close = ssl_read_closed_cleanly(ssl, bytes_read);
 			}
-			OPENSSL_cleanse(&msg, sizeof(msg));
-		} else {
-			log_openssl(LLVL_FATAL, "SSL_connect failed");
+			break;
 		}
-
-	} else {
-		log_openssl(LLVL_FATAL, "Cannot establish SSL context when trying to connect to server");
+		void *msg = volume_key_delivery ? (void*)&msgs[msg_count] : (void*)&msgs[msg_count].msg;
+		int bytes_read = SSL_read(ssl, msg, msg_size);
+		if ((bytes_read <= 0) && ssl_read_closed_cleanly(ssl, bytes_read)) {
+			/* Server closed the connection. */
+			*clean_close = true;
+			break;
+		}
+		if (bytes_read != msg_size) {
+			log_openssl(LLVL_FATAL, "SSL_read returned %d bytes when we expected to read %d", bytes_read, msg_size);
+			break;
+		}
+		if (msgs[msg_count].luks_volume_key_length > LUKS_VOLUME_KEY_MAX_SIZE_BYTES) {
+			log_msg(LLVL_WARNING, "Keyserver sent volume key of invalid length %u, ignoring it.", msgs[msg_count].luks_volume_key_length);
+			msgs[msg_count].luks_volume_key_length = 0;
+		}
+		msg_count++;
 	}
+	unlock_luks_volumes(keyclient, msgs, msg_count);
+	OPENSSL_cleanse(msgs, sizeof(msgs));
+	return msg_count;
+}
 
-	SSL_free(ssl);
-	free_generic_tls_context(&gctx);
-	return true;
+static unsigned int locked_volume_count(struct keyclient_t *keyclient) {
+	unsigned int count = 0;
+	const unsigned int volume_count = keyclient->keydb->hosts[0].volume_count;
+	for (unsigned int i = 0; i < volume_count; i++) {
+		if (!keyclient->volume_unlocked[i]) {
+			count++;
+		}
+	}
+	return count;
 }
 
-static bool contact_keyserver_ipv4(struct keyclient_t *keyclient, struct sockaddr_in *sockaddr_in, unsigned int port) {
-	sockaddr_in->sin_port = htons(port);
+static bool all_volumes_unlocked(struct keyclient_t *keyclient) {
+	return locked_volume_count(keyclient) == 0;
+}
 
-	int sd = socket(sockaddr_in->sin_family, SOCK_STREAM, 0);
-	if (sd == -1) {
-		log_libc(LLVL_ERROR, "Failed to create socket(3)");
-		return false;
-	}
+/* Races connections to all given keyservers and receives the keys from the
+ * first one that completes the TLS handshake. The outcome of every attempt is
+ * recorded in the keyserver health table. */
+static bool contact_keyservers(struct keyclient_t *keyclient, const struct sockaddr_storage *addresses, unsigned int address_count) {
+	const struct connection_race_config_t race_config = {
+		.ssl_ctx = keyclient->gctx.ctx,
+		.ssl_app_data = keyclient,
+		.stagger_millis = keyclient->opts->connect_stagger_millis,
+		.attempt_timeout_millis = keyclient->opts->connect_timeout_millis,
+	};
+	struct connection_race_result_t results[address_count];
+	SSL *ssl = connection_race_run(&race_config, addresses, address_count, results);
 
-	if (connect(sd, (struct sockaddr*)sockaddr_in, sizeof(struct sockaddr_in)) == -1) {
-		log_libc(LLVL_ERROR, "Failed to connect(3) to %d.%d.%d.%d:%d", PRINTF_FORMAT_IP(sockaddr_in), port);
+	unsigned int volume_count = 0;
+	bool clean_close = false;
+	if (ssl) {
+		const int sd = SSL_get_fd(ssl);
+		volume_count = receive_and_unlock_volumes(keyclient, ssl, &clean_close);
+		SSL_free(ssl);
+		shutdown(sd, SHUT_RDWR);
 		close(sd);
-		return false;
 	}
 
-	bool success = contact_keyserver_socket(keyclient, sd);
+	/* Servers which were cancelled in favor of another one remain untouched */
+	for (unsigned int i = 0; i < address_count; i++) {
+		struct ip_address_t ip;
+		ip_address_from_sockaddr(&ip, &addresses[i]);
+		char address_str[IP_ADDRESS_BUFSIZE];
+		sprintf_sockaddr(address_str, &addresses[i]);
+		switch (results[i].outcome) {
+			case RACE_ATTEMPT_FAILED:
+				keyserver_health_record_failure(&keyclient->keyserver_health, &ip);
+				break;
 
-	shutdown(sd, SHUT_RDWR);
-	close(sd);
-	return success;
+			case RACE_ATTEMPT_REJECTED:
+				log_msg(LLVL_WARNING, "Keyserver %s refused the TLS handshake, it likely does not serve this host.", address_str);
+				keyserver_health_record_rejection(&keyclient->keyserver_health, &ip, results[i].connect_time);
+				break;
+
+			case RACE_ATTEMPT_WON:
+				if (!clean_close) {
+					/* Restarting or overloaded server, retry it soon */
+					log_msg(LLVL_WARNING, "Keyserver %s dropped the connection after %u keys, will retry.", address_str, volume_count);
+					keyserver_health_record_failure(&keyclient->keyserver_health, &ip);
+					break;
+				}
+				if (volume_count == 0) {
+					log_msg(LLVL_WARNING, "Keyserver %s did not send any keys for this host.", address_str);
+				}
+				keyserver_health_record_delivery(&keyclient->keyserver_health, &ip, results[i].connect_time, volume_count, locked_volume_count(keyclient) > 0);
+				break;
+
+			default:
+				break;
+		}
+	}
+	return ssl != NULL;
 }
 
-static bool contact_keyserver_hostname(struct keyclient_t *keyclient, const char *hostname) {
+static unsigned int resolve_keyserver_hostname(struct keyclient_t *keyclient, const char *hostname, struct sockaddr_storage *addresses, unsigned int address_count, unsigned int max_address_count) {
 	struct addrinfo hints = {
-		.ai_family = AF_INET,
+		.ai_family = AF_UNSPEC,
 		.ai_socktype = SOCK_STREAM,
 	};
 	struct addrinfo *result;
 	int resolve_result = getaddrinfo(hostname, NULL, &hints, &result);
 	if (resolve_result) {
 		log_msg(LLVL_ERROR, "Failed to resolve hostname %s using getaddrinfo(3): %s", hostname, gai_strerror(resolve_result));
-		return false;
+		return address_count;
 	}
 
-	if (result->ai_addr->sa_family != AF_INET) {
-		freeaddrinfo(result);
-		log_msg(LLVL_ERROR, "getaddrinfo(3) returned non-IPv4 entry");
-		return false;
+	for (struct addrinfo *entry = result; entry && (address_count < max_address_count); entry = entry->ai_next) {
+		if ((entry->ai_addr->sa_family != AF_INET) && (entry->ai_addr->sa_family != AF_INET6)) {
+			continue;
+		}
+		struct sockaddr_storage address = { 0 };
+		memcpy(&address, entry->ai_addr, entry->ai_addrlen);
+		sockaddr_set_port(&address, keyclient->opts->port);
+
+		bool duplicate = false;
+		for (unsigned int i = 0; i < address_count; i++) {
+			if (sockaddr_same_host(&addresses[i], &address)) {
+				duplicate = true;
+				break;
+			}
+		}
+		if (!duplicate) {
+			char address_str[IP_ADDRESS_BUFSIZE];
+			sprintf_sockaddr(address_str, &address);
+			log_msg(LLVL_TRACE, "Resolved %s to %s", hostname, address_str);
+			addresses[address_count++] = address;
+		}
 	}
 
-	struct sockaddr_in *sin_address = (struct sockaddr_in*)result->ai_addr;
-	log_msg(LLVL_TRACE, "Resolved %s to %d.%d.%d.%d", hostname, PRINTF_FORMAT_IP(sin_address));
-
-	bool success = contact_keyserver_ipv4(keyclient, sin_address, keyclient->opts->port);
-
 	freeaddrinfo(result);
-	return success;
+	return address_count;
 }
 
-static unsigned int locked_volume_count(struct keyclient_t *keyclient) {
-	unsigned int count = 0;
-	const unsigned int volume_count = keyclient->keydb->hosts[0].volume_count;
-	for (unsigned int i = 0; i < volume_count; i++) {
-		if (!keyclient->volume_unlocked[i]) {
-			count++;
-		}
+static bool contact_keyserver_hostnames(struct keyclient_t *keyclient) {
+	struct sockaddr_storage addresses[KEYSERVER_MAX_CANDIDATES];
+	unsigned int address_count = 0;
+	for (unsigned int i = 0; i < keyclient->opts->hostname_count; i++) {
+		address_count = resolve_keyserver_hostname(keyclient, keyclient->opts->hostnames[i], addresses, address_count, KEYSERVER_MAX_CANDIDATES);
 	}
-	return count;
-}
-
-static bool all_volumes_unlocked(struct keyclient_t *keyclient) {
-	return locked_volume_count(keyclient) == 0;
+	if (address_count == 0) {
+		log_msg(LLVL_ERROR, "No address found for any of the %u given keyservers.", keyclient->opts->hostname_count);
+		return false;
+	}
+	return contact_keyservers(keyclient, addresses, address_count);
 }
 
 static unsigned int determine_timeout(struct keyclient_t *keyclient) {
@@ -255,6 +452,141 @@ static bool abort_searching_for_keyserver(struct keyclient_t *keyclient) {
 	return false;
 }
 
+struct keyserver_candidate_t {
+	struct sockaddr_storage address;
+	char address_str[IP_ADDRESS_BUFSIZE];
+	double response_time;
+	/* Interface the answer came in on, empty if unknown */
+	char interface[IF_NAMESIZE];
+};
+
+/* IPv4 answers are attributed by subnet, IPv6 ones by the zone of their
+ * link-local source address */
+static const struct udp_broadcast_target_t *broadcast_target_by_source(const struct udp_broadcast_target_t *targets, unsigned int target_count, const struct sockaddr_storage *src) {
+	for (unsigned int i = 0; i < target_count; i++) {
+		const struct udp_broadcast_target_t *target = &targets[i];
+		if (target->destination.ss_family != src->ss_family) {
+			continue;
+		}
+		if (src->ss_family == AF_INET) {
+			const uint32_t src_ip = ((const struct sockaddr_in*)src)->sin_addr.s_addr;
+			if ((src_ip & target->netmask) == (target->address & target->netmask)) {
+				return target;
+			}
+		} else if (((const struct sockaddr_in6*)src)->sin6_scope_id == target->interface_index) {
+			return target;
+		}
+	}
+	return NULL;
+}
+
+/* Broadcasts a single query and gathers all keyservers that answer within the
+ * listening time. After the first answer, further ones are only awaited for
+ * the discovery window.
+ * Answers arrive in order of their latency, so the candidates are returned
+ * ranked fastest first. */
+static unsigned int discover_keyservers(struct keyclient_t *keyclient, int sd, const struct udp_query_t *query, double listen_secs, struct keyserver_candidate_t *candidates, unsigned int max_candidates) {
+	/* Late answers to a previous round would distort the latency ranking */
+	{
+		struct sockaddr_storage src;
+		struct udp_response_t response;
+		while (wait_udp_response_timeout(sd, &response, &src, 0));
+	}
+
+	/* Interfaces may still be coming up while booting, therefore enumerate
+	 * them again for every broadcast */
+	struct udp_broadcast_target_t targets[UDP_MAX_BROADCAST_TARGETS];
+	const unsigned int target_count = enumerate_udp_broadcast_targets(targets, UDP_MAX_BROADCAST_TARGETS);
+	log_msg(LLVL_TRACE, "Broadcasting search for luksrku keyserver on %u interface(s)", target_count);
+	send_udp_broadcast_message_all(sd, keyclient->opts->port, targets, target_count, query, sizeof(*query));
+
+	const double broadcast_time = now();
+	double deadline = broadcast_time + listen_secs;
+	unsigned int candidate_count = 0;
+	while (candidate_count < max_candidates) {
+		const double remaining = deadline - now();
+		if (remaining <= 0) {
+			break;
+		}
+
+		struct sockaddr_storage src;
+		struct udp_response_t response;
+		if (!wait_udp_response_timeout(sd, &response, &src, (remaining * 1000) + 1)) {
+			continue;
+		}
+		const double response_time = now() - broadcast_time;
+
+		bool duplicate = false;
+		for (unsigned int i = 0; i < candidate_count; i++) {
+			if (sockaddr_same_host(&candidates[i].address, &src)) {
+				duplicate = true;
+				break;
+			}
+		}
+		if (duplicate) {
+			continue;
+		}
+
+		struct keyserver_candidate_t *candidate = &candidates[candidate_count++];
+		*candidate = (struct keyserver_candidate_t) {
+			.address = src,
+			.response_time = response_time,
+		};
+		sprintf_sockaddr(candidate->address_str, &src);
+		const struct udp_broadcast_target_t *target = broadcast_target_by_source(targets, target_count, &src);
+		if (target) {
+			memcpy(candidate->interface, target->interface, sizeof(candidate->interface));
+		}
+		log_msg(LLVL_TRACE, "Keyserver at %s answered via %s after %.1f ms", candidate->address_str, candidate->interface[0] ? candidate->interface : "unknown interface", response_time * 1000);
+		if (candidate_count == 1) {
+			const double window_deadline = now() + (keyclient->opts->discovery_window_millis / 1000.);
+			if (window_deadline < deadline) {
+				deadline = window_deadline;
+			}
+		}
+	}
+	return candidate_count;
+}
+
+static void wait_until(double deadline) {
+	const double remaining = deadline - now();
+	if (remaining > 0) {
+		struct timespec duration = {
+			.tv_sec = (time_t)remaining,
+			.tv_nsec = (remaining - (time_t)remaining) * 1e9,
+		};
+		nanosleep(&duration, NULL);
+	}
+}
+
+static double random_fraction(void) {
+	uint32_t value;
+	if (!buffer_randomize((uint8_t*)&value, sizeof(value))) {
+		return 0.5;
+	}
+	return value / 4294967296.;
+}
+
+/* Determines how long a discovery round lasts, i.e., the time until the next
+ * broadcast. The first probe uses the base interval, so that a keyserver which
+ * is up is found right away. Afterwards the interval doubles up to the
+ * configured ceiling and is jittered between half and the full interval, so
+ * that hosts which booted in lockstep after a power event drift apart. */
+static double discovery_round_interval(struct keyclient_t *keyclient, unsigned int round) {
+	const double ceiling = keyclient->opts->max_broadcast_interval_millis / 1000.;
+	double interval = WAITING_MESSAGE_BROADCAST_INTERVAL_MILLISECONDS / 1000.;
+	if (round == 0) {
+		return (interval < ceiling) ? interval : ceiling;
+	}
+	for (unsigned int i = 1; (i < round) && (interval < ceiling); i++) {
+		interval *= 2;
+	}
+	if (interval > ceiling) {
+		interval = ceiling;
+	}
+	return (interval / 2) + (random_fraction() * interval / 2);
+}
+
 static bool broadcast_for_keyserver(struct keyclient_t *keyclient) {
 	{
 		unsigned int client_timeout_secs = determine_timeout(keyclient);
@@ -265,42 +597,78 @@ static bool broadcast_for_keyserver(struct keyclient_t *keyclient) {
 		}
 	}
 
-	int sd = create_udp_socket(0, true, 1000);
+	int sd = create_udp_socket(0, true, 0, sizeof(struct udp_response_t));
 	if (sd == -1) {
 		return false;
 	}
 
-
 	keyclient->broadcast_start_time = now();
 	struct udp_query_t query;
 	memcpy(query.magic, UDP_MESSAGE_MAGIC, sizeof(query.magic));
 	memcpy(query.host_uuid, keyclient->keydb->hosts[0].host_uuid, 16);
+	const unsigned int client_timeout_secs = determine_timeout(keyclient);
+	unsigned int round = 0;
 	while (true) {
-		log_msg(LLVL_TRACE, "Broadcasting search for luksrku keyserver");
-		send_udp_broadcast_message(sd, keyclient->opts->port, &query, sizeof(query));
+		const double round_start_time = now();
+		double interval = discovery_round_interval(keyclient, round);
+		if (client_timeout_secs) {
+			/* Do not listen beyond the point where we give up anyways */
+			const double remaining = keyclient->broadcast_start_time + client_timeout_secs - round_start_time;
+			if (interval > remaining) {
+				interval = (remaining > 0) ? remaining : 0;
+			}
+		}
+		log_msg(LLVL_TRACE, "Discovery round %u lasts %.0f ms", round, interval * 1000);
 
-		struct sockaddr_in src = {
-			.sin_family = AF_INET,
-			.sin_port = htons(keyclient->opts->port),
-			.sin_addr.s_addr = htonl(INADDR_ANY),
-		};
-		struct udp_response_t response;
-		if (wait_udp_response(sd, &response, &src)) {
-			if (!is_ip_blacklisted(src.sin_addr.s_addr)) {
-				log_msg(LLVL_INFO, "Keyserver found at %d.%d.%d.%d", PRINTF_FORMAT_IP(&src));
-				blacklist_ip(src.sin_addr.s_addr, BLACKLIST_TIMEOUT_CLIENT);
-				if (!contact_keyserver_ipv4(keyclient, &src, keyclient->opts->port)) {
-					log_msg(LLVL_WARNING, "Keyserver announced at %d.%d.%d.%d, but connection to it failed.", PRINTF_FORMAT_IP(&src));
-				}
+		struct keyserver_candidate_t candidates[KEYSERVER_MAX_CANDIDATES];
+		unsigned int candidate_count = discover_keyservers(keyclient, sd, &query, interval, candidates, KEYSERVER_MAX_CANDIDATES);
+		if (candidate_count > 1) {
+			log_msg(LLVL_DEBUG, "%u keyservers answered, fastest after %.1f ms", candidate_count, candidates[0].response_time * 1000);
+		}
+
+		/* Race all servers which are due for a (re)try, fastest first */
+		struct sockaddr_storage addresses[KEYSERVER_MAX_CANDIDATES];
+		unsigned int address_count = 0;
+		for (unsigned int i = 0; i < candidate_count; i++) {
+			const struct keyserver_candidate_t *candidate = &candidates[i];
+			struct ip_address_t ip;
+			ip_address_from_sockaddr(&ip, &candidate->address);
+			const struct keyserver_health_entry_t *health = keyserver_health_lookup(&keyclient->keyserver_health, &ip);
+			if (!health) {
+				log_msg(LLVL_INFO, "Keyserver found at %s%s%s", candidate->address_str, candidate->interface[0] ? " on " : "", candidate->interface);
+			} else if (keyserver_health_eligible(&keyclient->keyserver_health, &ip)) {
+				log_msg(LLVL_INFO, "Keyserver found at %s, retrying after %u consecutive failure(s), %u volume key(s) received so far", candidate->address_str, health->consecutive_failures, health->volumes_delivered);
 			} else {
-				log_msg(LLVL_DEBUG, "Potential keyserver at %d.%d.%d.%d ignored, blacklist in effect.", PRINTF_FORMAT_IP(&src));
+				log_msg(LLVL_DEBUG, "Potential keyserver at %s ignored for another %.0f seconds.", candidate->address_str, health->retry_after - now());
+				continue;
+			}
+			addresses[address_count] = candidate->address;
+			sockaddr_set_port(&addresses[address_count], keyclient->opts->port);
+			address_count++;
+		}
+
+		const bool contacted_keyserver = (address_count > 0);
+		if (contacted_keyserver) {
+			if (!contact_keyservers(keyclient, addresses, address_count)) {
+				log_msg(LLVL_WARNING, "%u keyserver(s) announced, but connection to all of them failed.", address_count);
 			}
 		}
 
 		if (abort_searching_for_keyserver(keyclient)) {
 			break;
 		}
+
+		if (contacted_keyserver) {
+			/* Progress was made, look for the remaining keys quickly */
+			round = 0;
+		} else {
+			/* Do not flood the network when only servers answer which are not
+			 * due for a retry */
+			wait_until(round_start_time + interval);
+			round++;
+		}
 	}
+	close(sd);
 	return true;
 }
 
@@ -339,8 +707,14 @@ bool keyclient_start(const struct pgmopts_client_t *opts) {
 		}
 
 		/* Determine which of these volumes are already unlocked */
+		const char *mapping_names[MAX_VOLUMES_PER_HOST];
 		for (unsigned int i = 0; i < host->volume_count; i++) {
-			keyclient.volume_unlocked[i] = is_luks_device_opened(host->volumes[i].devmapper_name);
+			mapping_names[i] = host->volumes[i].devmapper_name;
+		}
+		if (!probe_opened_luks_devices(mapping_names, host->volume_count, keyclient.volume_unlocked)) {
+			for (unsigned int i = 0; i < host->volume_count; i++) {
+				keyclient.volume_unlocked[i] = is_luks_device_opened(host->volumes[i].devmapper_name);
+			}
 		}
 		if (all_volumes_unlocked(&keyclient)) {
 			log_msg(LLVL_INFO, "All %u volumes are unlocked already, not contacting luksrku key server.", host->volume_count);
@@ -352,9 +726,14 @@ bool keyclient_start(const struct pgmopts_client_t *opts) {
 		/* Transcribe the host UUID to ASCII so we only have to do this once */
 		sprintf_uuid((char*)keyclient.identifier, host->host_uuid);
 
-		if (opts->hostname) {
-			if (!contact_keyserver_hostname(&keyclient, opts->hostname)) {
-				log_msg(LLVL_ERROR, "Failed to contact key server: %s", opts->hostname);
+		if (!create_client_tls_context(&keyclient)) {
+			success = false;
+			break;
+		}
+
+		if (opts->hostname_count) {
+			if (!contact_keyserver_hostnames(&keyclient)) {
+				log_msg(LLVL_ERROR, "Failed to contact key server.");
 				success = false;
 				break;
 			}
@@ -367,6 +746,7 @@ bool keyclient_start(const struct pgmopts_client_t *opts) {
 		}
 	} while (false);
 
+	free_generic_tls_context(&keyclient.gctx);
 	if (keyclient.keydb) {
 		keydb_free(keyclient.keydb);
 	}
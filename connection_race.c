@@ -0,0 +1,331 @@
+/*
+	luksrku - Tool to remotely unlock LUKS disks using TLS.
+	Copyright (C) 2016-2026 Johannes Bauer
+
+	This file is part of luksrku.
+
+	luksrku is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; this program is ONLY licensed under
+	version 3 of the License, later versions are explicitly excluded.
+
+	luksrku is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with luksrku; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+	Johannes Bauer <JohannesBauer@gmx.de>
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+#include "connection_race.h"
+#include "log.h"
+#include "util.h"
+#include "ipaddr.h"
+
+enum race_attempt_state_t {
+	ATTEMPT_STATE_IDLE,
+	ATTEMPT_STATE_CONNECTING,
+	ATTEMPT_STATE_HANDSHAKE,
+	ATTEMPT_STATE_ESTABLISHED,
+};
+
+struct race_attempt_t {
+	enum race_attempt_state_t state;
+	const struct sockaddr_storage *address;
+	char address_str[IP_ADDRESS_BUFSIZE];
+	int sd;
+	SSL *ssl;
+	short poll_events;
+	double start_time;
+	double connect_time;
+	double deadline;
+};
+
+static bool set_nonblocking(int fd, bool nonblocking) {
+	int flags = fcntl(fd, F_GETFL);
+	if (flags == -1) {
+		return false;
+	}
+	flags = nonblocking ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+	return fcntl(fd, F_SETFL, flags) != -1;
+}
+
+static void race_attempt_free(struct race_attempt_t *attempt) {
+	SSL_free(attempt->ssl);
+	if (attempt->sd != -1) {
+		close(attempt->sd);
+	}
+	attempt->ssl = NULL;
+	attempt->sd = -1;
+	attempt->state = ATTEMPT_STATE_IDLE;
+}
+
+static bool race_attempt_start(const struct connection_race_config_t *config, struct race_attempt_t *attempt) {
+	attempt->sd = socket(attempt->address->ss_family, SOCK_STREAM, 0);
+	if (attempt->sd == -1) {
+		log_libc(LLVL_ERROR, "Failed to create socket(3)");
+		return false;
+	}
+	if (!set_nonblocking(attempt->sd, true)) {
+		log_libc(LLVL_ERROR, "Failed to make socket non-blocking");
+		race_attempt_free(attempt);
+		return false;
+	}
+
+	log_msg(LLVL_TRACE, "Connecting to %s port %u", attempt->address_str, sockaddr_get_port(attempt->address));
+	attempt->start_time = now();
+	attempt->deadline = attempt->start_time + (config->attempt_timeout_millis / 1000.);
+	attempt->connect_time = -1;
+	if (connect(attempt->sd, (const struct sockaddr*)attempt->address, sockaddr_length(attempt->address)) == 0) {
+		attempt->state = ATTEMPT_STATE_HANDSHAKE;
+		attempt->connect_time = now() - attempt->start_time;
+	} else if (errno == EINPROGRESS) {
+		attempt->state = ATTEMPT_STATE_CONNECTING;
+		attempt->poll_events = POLLOUT;
+	} else {
+		log_libc(LLVL_ERROR, "Failed to connect(3) to %s port %u", attempt->address_str, sockaddr_get_port(attempt->address));
+		race_attempt_free(attempt);
+		return false;
+	}
+
+	attempt->ssl = SSL_new(config->ssl_ctx);
+	if (!attempt->ssl) {
+		log_openssl(LLVL_FATAL, "Cannot establish SSL context when trying to connect to server");
+		race_attempt_free(attempt);
+		return false;
+	}
+	SSL_set_fd(attempt->ssl, attempt->sd);
+	SSL_set_app_data(attempt->ssl, config->ssl_app_data);
+	SSL_set_connect_state(attempt->ssl);
+	return true;
+}
+
+/* Only an alert by which the server states that it does not know or does not
+ * accept our credentials counts as a rejection. Everything else, e.g., a
+ * reset or EOF mid-handshake of a restarting or overloaded server, is a
+ * transient failure. Must be called before the error queue is consumed. */
+static bool race_attempt_rejected(SSL *ssl, int result) {
+	if (SSL_get_error(ssl, result) != SSL_ERROR_SSL) {
+		return false;
+	}
+	switch (ERR_GET_REASON(ERR_peek_last_error())) {
+		case SSL_R_SSLV3_ALERT_HANDSHAKE_FAILURE:
+		case SSL_R_TLSV1_ALERT_ACCESS_DENIED:
+		case SSL_R_TLSV1_ALERT_DECRYPT_ERROR:
+		case SSL_R_TLSV1_ALERT_UNKNOWN_PSK_IDENTITY:
+			return true;
+
+		default:
+			return false;
+	}
+}
+
+/* Advances the attempt after its socket became ready. Returns false if the
+ * attempt failed, in which case it has been freed and the outcome is set. */
+static bool race_attempt_progress(struct race_attempt_t *attempt, enum connection_race_outcome_t *outcome) {
+	if (attempt->state == ATTEMPT_STATE_CONNECTING) {
+		int error = 0;
+		socklen_t error_len = sizeof(error);
+		if (getsockopt(attempt->sd, SOL_SOCKET, SO_ERROR, &error, &error_len) || error) {
+			log_msg(LLVL_ERROR, "Failed to connect(3) to %s port %u: %s (%d)", attempt->address_str, sockaddr_get_port(attempt->address), strerror(error), error);
+			race_attempt_free(attempt);
+			*outcome = RACE_ATTEMPT_FAILED;
+			return false;
+		}
+		attempt->state = ATTEMPT_STATE_HANDSHAKE;
+		attempt->connect_time = now() - attempt->start_time;
+	}
+
+	/* Attempts share the thread's error queue */
+	ERR_clear_error();
+	int result = SSL_connect(attempt->ssl);
+	if (result == 1) {
+		attempt->state = ATTEMPT_STATE_ESTABLISHED;
+		return true;
+	}
+	switch (SSL_get_error(attempt->ssl, result)) {
+		case SSL_ERROR_WANT_READ:
+			attempt->poll_events = POLLIN;
+			return true;
+
+		case SSL_ERROR_WANT_WRITE:
+			attempt->poll_events = POLLOUT;
+			return true;
+
+		default:
+			*outcome = race_attempt_rejected(attempt->ssl, result) ? RACE_ATTEMPT_REJECTED : RACE_ATTEMPT_FAILED;
+			log_openssl(LLVL_ERROR, "SSL_connect to %s failed", attempt->address_str);
+			race_attempt_free(attempt);
+			return false;
+	}
+}
+
+/* Connects to the given addresses in a staggered fashion: the next address is
+ * tried once the stagger delay has passed or all pending attempts failed. The
+ * first attempt that completes its TLS handshake wins, all others are
+ * cancelled. The winning connection is returned in blocking mode and its
+ * socket (SSL_get_fd()) is owned by the caller. Optionally reports the outcome
+ * and TCP connect time of every attempt. */
+SSL *connection_race_run(const struct connection_race_config_t *config, const struct sockaddr_storage *addresses, unsigned int address_count, struct connection_race_result_t *results) {
+	struct race_attempt_t attempts[address_count];
+	enum connection_race_outcome_t outcomes[address_count];
+	for (unsigned int i = 0; i < address_count; i++) {
+		attempts[i] = (struct race_attempt_t) {
+			.state = ATTEMPT_STATE_IDLE,
+			.address = &addresses[i],
+			.sd = -1,
+			.connect_time = -1,
+		};
+		sprintf_sockaddr(attempts[i].address_str, &addresses[i]);
+		outcomes[i] = RACE_ATTEMPT_NOT_STARTED;
+	}
+
+	SSL *winner = NULL;
+	unsigned int next_index = 0;
+	unsigned int pending_count = 0;
+	double next_start_time = now();
+	while (!winner) {
+		double current_time = now();
+		if ((next_index < address_count) && ((current_time >= next_start_time) || (pending_count == 0))) {
+			struct race_attempt_t *attempt = &attempts[next_index];
+			bool started = race_attempt_start(config, attempt);
+			if (!started) {
+				outcomes[next_index] = RACE_ATTEMPT_FAILED;
+			} else if (attempt->state == ATTEMPT_STATE_HANDSHAKE) {
+				/* Connected immediately, e.g., on the loopback interface */
+				started = race_attempt_progress(attempt, &outcomes[next_index]);
+			}
+			if (started) {
+				pending_count++;
+				if (attempt->state == ATTEMPT_STATE_ESTABLISHED) {
+					winner = attempt->ssl;
+				}
+			}
+			next_index++;
+			next_start_time = current_time + (config->stagger_millis / 1000.);
+			continue;
+		}
+		if (pending_count == 0) {
+			/* Every address has been tried and failed */
+			break;
+		}
+
+		/* Expire attempts and determine how long we may wait */
+		double wakeup_time = (next_index < address_count) ? next_start_time : (current_time + 3600);
+		struct pollfd pfds[address_count];
+		unsigned int pfd_attempt[address_count];
+		unsigned int pfd_count = 0;
+		for (unsigned int i = 0; i < next_index; i++) {
+			struct race_attempt_t *attempt = &attempts[i];
+			if (attempt->state == ATTEMPT_STATE_IDLE) {
+				continue;
+			}
+			if (current_time >= attempt->deadline) {
+				log_msg(LLVL_WARNING, "Connection to %s timed out after %u ms.", attempt->address_str, config->attempt_timeout_millis);
+				race_attempt_free(attempt);
+				pending_count--;
+				outcomes[i] = RACE_ATTEMPT_FAILED;
+				continue;
+			}
+			if (attempt->deadline < wakeup_time) {
+				wakeup_time = attempt->deadline;
+			}
+			pfds[pfd_count] = (struct pollfd) {
+				.fd = attempt->sd,
+				.events = attempt->poll_events,
+			};
+			pfd_attempt[pfd_count] = i;
+			pfd_count++;
+		}
+		if (pfd_count == 0) {
+			continue;
+		}
+
+		int timeout_millis = ((wakeup_time - current_time) * 1000) + 1;
+		int ready = poll(pfds, pfd_count, timeout_millis);
+		if (ready < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			log_libc(LLVL_ERROR, "poll(2) failed while connecting to keyservers");
+			break;
+		}
+
+		for (unsigned int i = 0; (i < pfd_count) && (ready > 0); i++) {
+			if (!pfds[i].revents) {
+				continue;
+			}
+			ready--;
+			const unsigned int index = pfd_attempt[i];
+			struct race_attempt_t *attempt = &attempts[index];
+			if (!race_attempt_progress(attempt, &outcomes[index])) {
+				pending_count--;
+			} else if (attempt->state == ATTEMPT_STATE_ESTABLISHED) {
+				winner = attempt->ssl;
+				break;
+			}
+		}
+	}
+
+	/* Cancel everything but the winner */
+	for (unsigned int i = 0; i < address_count; i++) {
+		struct race_attempt_t *attempt = &attempts[i];
+		if (attempt->ssl && (attempt->ssl == winner)) {
+			log_msg(LLVL_DEBUG, "TLS connection to %s established after %.1f ms.", attempt->address_str, (now() - attempt->start_time) * 1000);
+			outcomes[i] = RACE_ATTEMPT_WON;
+		}
+	}
+	for (unsigned int i = 0; i < address_count; i++) {
+		struct race_attempt_t *attempt = &attempts[i];
+		if ((attempt->state != ATTEMPT_STATE_IDLE) && (attempt->ssl != winner)) {
+			log_msg(LLVL_TRACE, "Cancelling connection attempt to %s", attempt->address_str);
+			race_attempt_free(attempt);
+			outcomes[i] = RACE_ATTEMPT_CANCELLED;
+		}
+	}
+
+	if (results) {
+		for (unsigned int i = 0; i < address_count; i++) {
+			results[i] = (struct connection_race_result_t) {
+				.outcome = outcomes[i],
+				.connect_time = attempts[i].connect_time,
+			};
+		}
+	}
+
+	if (winner) {
+		/* The caller transfers data synchronously, but must not wait forever
+		 * on a server that stalls after the handshake */
+		const int sd = SSL_get_fd(winner);
+		struct timeval tv = {
+			.tv_sec = config->attempt_timeout_millis / 1000,
+			.tv_usec = (config->attempt_timeout_millis % 1000) * 1000,
+		};
+		if (!set_nonblocking(sd, false) || setsockopt(sd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv))) {
+			log_libc(LLVL_ERROR, "Unable to switch keyserver connection to blocking mode");
+			SSL_free(winner);
+			close(sd);
+			winner = NULL;
+		}
+	}
+	return winner;
+}
@@ -0,0 +1,66 @@
+/*
+	luksrku - Tool to remotely unlock LUKS disks using TLS.
+	Copyright (C) 2016-2026 Johannes Bauer
+
+	This file is part of luksrku.
+
+	luksrku is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; this program is ONLY licensed under
+	version 3 of the License, later versions are explicitly excluded.
+
+	luksrku is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with luksrku; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+	Johannes Bauer <JohannesBauer@gmx.de>
+*/
+
+
+#ifndef __CONNECTION_RACE_H__
+#define __CONNECTION_RACE_H__
+
+#include <stdbool.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <openssl/ssl.h>
+
+enum connection_race_outcome_t {
+	RACE_ATTEMPT_NOT_STARTED = 0,
+	/* TCP connection or TLS handshake could not be completed, e.g., because
+	 * of a timeout or a connection reset */
+	RACE_ATTEMPT_FAILED,
+	/* TCP connection was established, but the server refused our
+	 * credentials with a TLS alert */
+	RACE_ATTEMPT_REJECTED,
+	RACE_ATTEMPT_CANCELLED,
+	RACE_ATTEMPT_WON,
+};
+
+struct connection_race_result_t {
+	enum connection_race_outcome_t outcome;
+	/* Duration of the TCP connect in seconds, negative if not connected */
+	double connect_time;
+};
+
+struct connection_race_config_t {
+	SSL_CTX *ssl_ctx;
+	/* Set as SSL application data of every attempt */
+	void *ssl_app_data;
+	/* Delay after which the next address is tried while the previous
+	 * attempts are still pending */
+	unsigned int stagger_millis;
+	/* Every attempt must complete TCP and TLS handshakes within this time */
+	unsigned int attempt_timeout_millis;
+};
+
+/*************** AUTO GENERATED SECTION FOLLOWS ***************/
+SSL *connection_race_run(const struct connection_race_config_t *config, const struct sockaddr_storage *addresses, unsigned int address_count, struct connection_race_result_t *results);
+/***************  AUTO GENERATED SECTION ENDS   ***************/
+
+#endif
@@ -26,6 +26,7 @@
 #include <string.h>
 #include <strings.h>
 #include <stdbool.h>
+#include <errno.h>
 #include <openssl/crypto.h>
 #include "editor.h"
 #include "util.h"
@@ -71,6 +72,7 @@ static enum cmd_returncode_t cmd_del_volume(struct editor_context_t *ctx, const
 static enum cmd_returncode_t cmd_rekey_volume(struct editor_context_t *ctx, const char *cmdname, unsigned int param_cnt, char **params);
 static enum cmd_returncode_t cmd_showkey_volume(struct editor_context_t *ctx, const char *cmdname, unsigned int param_cnt, char **params);
 static enum cmd_returncode_t cmd_flag_volume(struct editor_context_t *ctx, const char *cmdname, unsigned int param_cnt, char **params);
+static enum cmd_returncode_t cmd_import_volume_key(struct editor_context_t *ctx, const char *cmdname, unsigned int param_cnt, char **params);
 static enum cmd_returncode_t cmd_open(struct editor_context_t *ctx, const char *cmdname, unsigned int param_cnt, char **params);
 static enum cmd_returncode_t cmd_save(struct editor_context_t *ctx, const char *cmdname, unsigned int param_cnt, char **params);
 static enum cmd_returncode_t cmd_export(struct editor_context_t *ctx, const char *cmdname, unsigned int param_cnt, char **params);
@@ -162,11 +164,19 @@ static const struct editor_command_t commands[] = {
 	{
 		.cmdnames = { "flag_volume" },
 		.callback = cmd_flag_volume,
-		.param_names = "[hostname] [devmappername] [(+-)(allow_discards)]",
+		.param_names = "[hostname] [devmappername] [(+-)(allow_discards|deliver_volume_key)]",
 		.min_params = 3,
 		.max_params = 3,
 		.description = "Edits the flags of a volume",
 	},
+	{
+		.cmdnames = { "import_volume_key" },
+		.callback = cmd_import_volume_key,
+		.param_names = "[hostname] [devmappername] [filename]",
+		.min_params = 3,
+		.max_params = 3,
+		.description = "Imports the raw LUKS volume key of a volume from a file",
+	},
 	{
 		.cmdnames = { "open", "load" },
 		.callback = cmd_open,
@@ -267,6 +277,12 @@ static enum cmd_returncode_t cmd_list(struct editor_context_t *ctx, const char *
 				if (volume->volume_flags & VOLUME_FLAG_ALLOW_DISCARDS) {
 					printf("allow_discards ");
 				}
+				if (volume->volume_flags & VOLUME_FLAG_DELIVER_VOLUME_KEY) {
+					printf("deliver_volume_key ");
+					if (ctx->keydb->server_database && !volume->luks_volume_key_length) {
+						printf("(no volume key imported) ");
+					}
+				}
 			}
 			printf("\n");
 		}
@@ -445,8 +461,10 @@ static enum cmd_returncode_t cmd_flag_volume(struct editor_context_t *ctx, const
 	unsigned int flag_value = 0;
 	if (!strcasecmp(flag_str + 1, "allow_discards")) {
 		flag_value = VOLUME_FLAG_ALLOW_DISCARDS;
+	} else if (!strcasecmp(flag_str + 1, "deliver_volume_key")) {
+		flag_value = VOLUME_FLAG_DELIVER_VOLUME_KEY;
 	} else {
-		fprintf(stderr, "Invalid flag '%s': allowed is only 'allow_discards'.\n", flag_str + 1);
+		fprintf(stderr, "Invalid flag '%s': allowed are 'allow_discards' and 'deliver_volume_key'.\n", flag_str + 1);
 		return COMMAND_FAILURE;
 	}
 
@@ -459,6 +477,41 @@ static enum cmd_returncode_t cmd_flag_volume(struct editor_context_t *ctx, const
 	return COMMAND_SUCCESS;
 }
 
+static enum cmd_returncode_t cmd_import_volume_key(struct editor_context_t *ctx, const char *cmdname, unsigned int param_cnt, char **params) {
+	const char *host_name = params[0];
+	const char *devmapper_name = params[1];
+	const char *filename = params[2];
+
+	volume_entry_t *volume = cmd_getvolume(ctx, host_name, devmapper_name);
+	if (!volume) {
+		return COMMAND_FAILURE;
+	}
+
+	FILE *f = fopen(filename, "r");
+	if (!f) {
+		fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+		return COMMAND_FAILURE;
+	}
+
+	/* Read one byte more than allowed to detect oversized files */
+	uint8_t volume_key[LUKS_VOLUME_KEY_MAX_SIZE_BYTES + 1];
+	size_t volume_key_length = fread(volume_key, 1, sizeof(volume_key), f);
+	fclose(f);
+
+	enum cmd_returncode_t result = COMMAND_FAILURE;
+	if ((volume_key_length < 16) || (volume_key_length > LUKS_VOLUME_KEY_MAX_SIZE_BYTES)) {
+		fprintf(stderr, "%s: volume key must be between 16 and %d bytes of raw binary data.\n", filename, LUKS_VOLUME_KEY_MAX_SIZE_BYTES);
+	} else if (keydb_set_volume_key(volume, volume_key, volume_key_length)) {
+		printf("Imported %zu bit volume key for %s.\n", volume_key_length * 8, volume->devmapper_name);
+		if (!(volume->volume_flags & VOLUME_FLAG_DELIVER_VOLUME_KEY)) {
+			printf("Note that it is only sent to the client after setting the deliver_volume_key flag.\n");
+		}
+		result = COMMAND_SUCCESS;
+	}
+	OPENSSL_cleanse(volume_key, sizeof(volume_key));
+	return result;
+}
+
 static enum cmd_returncode_t cmd_open(struct editor_context_t *ctx, const char *cmdname, unsigned int param_cnt, char **params) {
 	if (ctx->keydb) {
 		keydb_free(ctx->keydb);
@@ -530,19 +583,17 @@ static enum cmd_returncode_t cmd_test(struct editor_context_t *ctx, const char *
 			fprintf(stderr, "No keydb.\n");
 			return COMMAND_FAILURE;
 		}
-		struct vaulted_keydb_t *vkdb = vaulted_keydb_new(ctx->keydb);
-		fprintf(stderr, "Vault created at %p.\n", vkdb);
-		fprintf(stderr, "TLS-PSK vault %u bytes:\n", vkdb->tls_psk_vault->data_length);
-		dump_hex_long(stderr, vkdb->tls_psk_vault->data, vkdb->tls_psk_vault->data_length);
-		fprintf(stderr, "LUKS vault %u bytes:\n", vkdb->luks_passphrase_vault->data_length);
-		dump_hex_long(stderr, vkdb->luks_passphrase_vault->data, vkdb->luks_passphrase_vault->data_length);
-
-		fprintf(stderr, "~~~~~~~~~~~~~~~~ decrypted TLS-PSK ~~~~~~~~~~~~~~~~\n");
-		vault_open(vkdb->tls_psk_vault);
-		dump_hex_long(stderr, vkdb->tls_psk_vault->data, vkdb->tls_psk_vault->data_length);
-		fprintf(stderr, "~~~~~~~~~~~~~~~~ decrypted LUKS ~~~~~~~~~~~~~~~~\n");
-		vault_open(vkdb->luks_passphrase_vault);
-		dump_hex_long(stderr, vkdb->luks_passphrase_vault->data, vkdb->luks_passphrase_vault->data_length);
+		struct vaulted_keydb_t *vkdb = vaulted_keydb_new(ctx->keydb, 0, 0);
+		fprintf(stderr, "Vault created at %p with %u shards.\n", vkdb, vkdb->shard_count);
+		for (unsigned int i = 0; i < vkdb->shard_count; i++) {
+			struct vault_t *vault = vkdb->shards[i].vault;
+			fprintf(stderr, "Shard %u vault %u bytes:\n", i, vault->data_length);
+			dump_hex_long(stderr, vault->data, vault->data_length);
+
+			fprintf(stderr, "~~~~~~~~~~~~~~~~ decrypted ~~~~~~~~~~~~~~~~\n");
+			vault_open(vault);
+			dump_hex_long(stderr, vault->data, vault->data_length);
+		}
 		vaulted_keydb_free(vkdb);
 		return COMMAND_SUCCESS;
 	}
@@ -577,6 +628,7 @@ static enum cmd_returncode_t cmd_rawdump(struct editor_context_t *ctx, const cha
 				dump_hexline(stderr, "        volume_uuid     ", volume->volume_uuid, sizeof(volume->volume_uuid), false);
 				dump_hexline(stderr, "        devmapper_name  ", volume->devmapper_name, sizeof(volume->devmapper_name), true);
 				dump_hexline(stderr, "        luks_passphrase ", volume->luks_passphrase_raw, sizeof(volume->luks_passphrase_raw), false);
+				dump_hexline(stderr, "        luks_volume_key ", volume->luks_volume_key, volume->luks_volume_key_length, false);
 			}
 		}
 	}
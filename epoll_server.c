@@ -0,0 +1,497 @@
+/*
+	luksrku - Tool to remotely unlock LUKS disks using TLS.
+	Copyright (C) 2016-2026 Johannes Bauer
+
+	This file is part of luksrku.
+
+	luksrku is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; this program is ONLY licensed under
+	version 3 of the License, later versions are explicitly excluded.
+
+	luksrku is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with luksrku; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+	Johannes Bauer <JohannesBauer@gmx.de>
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+#include "epoll_server.h"
+#include "log.h"
+#include "util.h"
+
+enum epoll_connection_state_t {
+	CONNECTION_STATE_HANDSHAKE,
+	CONNECTION_STATE_PARKED,
+	CONNECTION_STATE_TRANSMIT,
+};
+
+struct epoll_loop_t;
+
+struct epoll_connection_t {
+	struct epoll_connection_t *prev, *next;
+	struct epoll_loop_t *loop;
+	enum epoll_connection_state_t state;
+	/* Parked connection that exceeded its deadline, closed when resumed */
+	bool expired;
+	/* Link in the loop's resume queue */
+	struct epoll_connection_t *resume_next;
+	int fd;
+	SSL *ssl;
+	void *connection_ctx;
+	bool registered;
+	uint32_t registered_events;
+	const void *txdata;
+	unsigned int txlength;
+	double deadline;
+};
+
+struct epoll_loop_t {
+	const struct epoll_server_config_t *config;
+	unsigned int loop_id;
+	int listen_sd;
+	int epoll_fd;
+	pthread_t thread;
+	bool thread_running;
+	struct epoll_connection_t *connections;
+	unsigned int connection_count;
+
+	/* Parked connections are handed back to the loop from other threads
+	 * through this queue; the eventfd wakes the loop up */
+	int wakeup_fd;
+	pthread_mutex_t resume_mutex;
+	struct epoll_connection_t *resume_queue;
+};
+
+/* Marks the wakeup eventfd in epoll events; listening sockets use NULL */
+static char epoll_wakeup_marker;
+
+static bool set_nonblocking(int fd) {
+	int flags = fcntl(fd, F_GETFL);
+	if (flags == -1) {
+		return false;
+	}
+	return fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1;
+}
+
+static void epoll_connection_close(struct epoll_loop_t *loop, struct epoll_connection_t *conn) {
+	epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+	loop->config->callbacks.connection_close(conn->connection_ctx);
+	SSL_free(conn->ssl);
+	shutdown(conn->fd, SHUT_RDWR);
+	close(conn->fd);
+
+	if (conn->prev) {
+		conn->prev->next = conn->next;
+	} else {
+		loop->connections = conn->next;
+	}
+	if (conn->next) {
+		conn->next->prev = conn->prev;
+	}
+	loop->connection_count--;
+	free(conn);
+}
+
+static bool epoll_connection_register(struct epoll_loop_t *loop, struct epoll_connection_t *conn, uint32_t events) {
+	if (conn->registered && (conn->registered_events == events)) {
+		return true;
+	}
+	struct epoll_event event = {
+		.events = events,
+		.data.ptr = conn,
+	};
+	if (epoll_ctl(loop->epoll_fd, conn->registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, conn->fd, &event) == -1) {
+		log_libc(LLVL_ERROR, "Unable to register client socket with epoll_ctl(2)");
+		return false;
+	}
+	conn->registered = true;
+	conn->registered_events = events;
+	return true;
+}
+
+/* Removes the descriptor from the epoll set altogether. Registering it
+ * without events would not do, since EPOLLERR and EPOLLHUP are always
+ * reported and would make the level-triggered loop spin. */
+static bool epoll_connection_unregister(struct epoll_loop_t *loop, struct epoll_connection_t *conn) {
+	if (!conn->registered) {
+		return true;
+	}
+	if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL) == -1) {
+		log_libc(LLVL_ERROR, "Unable to unregister client socket with epoll_ctl(2)");
+		return false;
+	}
+	conn->registered = false;
+	conn->registered_events = 0;
+	return true;
+}
+
+/* Returns true if the connection should be kept open and waits for the
+ * condition that OpenSSL asked for, false if it needs to be closed. */
+static bool epoll_connection_wait(struct epoll_loop_t *loop, struct epoll_connection_t *conn, int ssl_result, const char *operation) {
+	int error = SSL_get_error(conn->ssl, ssl_result);
+	switch (error) {
+		case SSL_ERROR_WANT_READ:
+			return epoll_connection_register(loop, conn, EPOLLIN);
+
+		case SSL_ERROR_WANT_WRITE:
+			return epoll_connection_register(loop, conn, EPOLLOUT);
+
+		case SSL_ERROR_WANT_CLIENT_HELLO_CB:
+			/* Socket events are of no interest until the handshake is
+			 * resumed. If the client hangs up meanwhile, the resumed
+			 * handshake notices. The connection must be kept even if
+			 * this fails, another thread will resume it. */
+			conn->state = CONNECTION_STATE_PARKED;
+			epoll_connection_unregister(loop, conn);
+			return true;
+
+		case SSL_ERROR_ZERO_RETURN:
+			log_msg(LLVL_DEBUG, "Client closed connection during %s.", operation);
+			return false;
+
+		case SSL_ERROR_SYSCALL:
+			if (errno) {
+				log_libc(LLVL_WARNING, "Client connection failed during %s", operation);
+			} else {
+				log_msg(LLVL_WARNING, "Client disconnected during %s.", operation);
+			}
+			return false;
+
+		default:
+			log_openssl(LLVL_WARNING, "Could not complete %s with connecting client.", operation);
+			return false;
+	}
+}
+
+static void epoll_connection_advance(struct epoll_loop_t *loop, struct epoll_connection_t *conn) {
+	if (conn->state == CONNECTION_STATE_PARKED) {
+		/* Only epoll_loop_resume_connections() continues these */
+		return;
+	}
+
+	if (conn->state == CONNECTION_STATE_HANDSHAKE) {
+		ERR_clear_error();
+		errno = 0;
+		int result = SSL_accept(conn->ssl);
+		if (result != 1) {
+			if (!epoll_connection_wait(loop, conn, result, "TLS handshake")) {
+				epoll_connection_close(loop, conn);
+			}
+			return;
+		}
+
+		if (!loop->config->callbacks.connection_established(conn->connection_ctx, conn->ssl, &conn->txdata, &conn->txlength)) {
+			epoll_connection_close(loop, conn);
+			return;
+		}
+		conn->state = CONNECTION_STATE_TRANSMIT;
+	}
+
+	if (conn->state == CONNECTION_STATE_TRANSMIT) {
+		if (conn->txlength == 0) {
+			epoll_connection_close(loop, conn);
+			return;
+		}
+
+		/* A SSL_write(3) that returned WANT_READ or WANT_WRITE must be
+		 * retried with identical arguments, which we guarantee since the
+		 * payload is owned by the connection context. */
+		ERR_clear_error();
+		errno = 0;
+		int txlen = SSL_write(conn->ssl, conn->txdata, conn->txlength);
+		if (txlen > 0) {
+			if ((unsigned int)txlen != conn->txlength) {
+				log_msg(LLVL_WARNING, "Tried to send message of %u bytes, but sent %d. Severing connection to client.", conn->txlength, txlen);
+			}
+			epoll_connection_close(loop, conn);
+		} else if (!epoll_connection_wait(loop, conn, txlen, "transmission")) {
+			epoll_connection_close(loop, conn);
+		}
+	}
+}
+
+static void epoll_loop_add_connection(struct epoll_loop_t *loop, int fd) {
+	if (!set_nonblocking(fd)) {
+		log_libc(LLVL_ERROR, "Unable to set client socket non-blocking");
+		close(fd);
+		return;
+	}
+
+	struct epoll_connection_t *conn = calloc(1, sizeof(struct epoll_connection_t));
+	if (!conn) {
+		log_libc(LLVL_ERROR, "Unable to calloc(3) client connection");
+		close(fd);
+		return;
+	}
+	conn->loop = loop;
+	conn->fd = fd;
+	conn->state = CONNECTION_STATE_HANDSHAKE;
+	conn->deadline = now() + (EPOLL_SERVER_CONNECTION_TIMEOUT_MILLIS / 1000.);
+
+	conn->ssl = SSL_new(loop->config->ssl_ctx);
+	if (!conn->ssl) {
+		log_openssl(LLVL_FATAL, "Cannot establish SSL context for connecting client");
+		close(fd);
+		free(conn);
+		return;
+	}
+
+	conn->connection_ctx = loop->config->callbacks.connection_open(loop->config->server_ctx, fd, conn);
+	if (!conn->connection_ctx) {
+		SSL_free(conn->ssl);
+		close(fd);
+		free(conn);
+		return;
+	}
+	SSL_set_fd(conn->ssl, fd);
+	SSL_set_app_data(conn->ssl, conn->connection_ctx);
+	SSL_set_accept_state(conn->ssl);
+
+	conn->next = loop->connections;
+	if (conn->next) {
+		conn->next->prev = conn;
+	}
+	loop->connections = conn;
+	loop->connection_count++;
+
+	if (!epoll_connection_register(loop, conn, EPOLLIN)) {
+		epoll_connection_close(loop, conn);
+	}
+}
+
+static void epoll_loop_accept(struct epoll_loop_t *loop) {
+	while (true) {
+		int fd = accept(loop->listen_sd, NULL, NULL);
+		if (fd == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+				log_libc(LLVL_ERROR, "Unable to accept(2)");
+			}
+			return;
+		}
+		epoll_loop_add_connection(loop, fd);
+	}
+}
+
+static void epoll_loop_expire_connections(struct epoll_loop_t *loop) {
+	const double current_time = now();
+	struct epoll_connection_t *conn = loop->connections;
+	while (conn) {
+		struct epoll_connection_t *next = conn->next;
+		if ((current_time > conn->deadline) && !conn->expired) {
+			log_msg(LLVL_WARNING, "Client did not complete transfer within %u ms, severing connection.", EPOLL_SERVER_CONNECTION_TIMEOUT_MILLIS);
+			if (conn->state == CONNECTION_STATE_PARKED) {
+				/* Another thread still refers to the connection */
+				conn->expired = true;
+			} else {
+				epoll_connection_close(loop, conn);
+			}
+		}
+		conn = next;
+	}
+}
+
+/* Hands a parked connection back to its event loop; may be called from any
+ * thread. */
+void epoll_server_resume(struct epoll_connection_t *conn) {
+	struct epoll_loop_t *loop = conn->loop;
+	pthread_mutex_lock(&loop->resume_mutex);
+	conn->resume_next = loop->resume_queue;
+	loop->resume_queue = conn;
+	pthread_mutex_unlock(&loop->resume_mutex);
+
+	const uint64_t increment = 1;
+	if (write(loop->wakeup_fd, &increment, sizeof(increment)) != sizeof(increment)) {
+		log_libc(LLVL_ERROR, "Unable to wake up event loop %u", loop->loop_id);
+	}
+}
+
+static void epoll_loop_resume_connections(struct epoll_loop_t *loop) {
+	uint64_t counter;
+	if (read(loop->wakeup_fd, &counter, sizeof(counter)) != sizeof(counter)) {
+		return;
+	}
+
+	pthread_mutex_lock(&loop->resume_mutex);
+	struct epoll_connection_t *conn = loop->resume_queue;
+	loop->resume_queue = NULL;
+	pthread_mutex_unlock(&loop->resume_mutex);
+
+	while (conn) {
+		struct epoll_connection_t *next = conn->resume_next;
+		conn->resume_next = NULL;
+		conn->state = CONNECTION_STATE_HANDSHAKE;
+		if (conn->expired) {
+			epoll_connection_close(loop, conn);
+		} else {
+			epoll_connection_advance(loop, conn);
+		}
+		conn = next;
+	}
+}
+
+static void* epoll_loop_thread(void *vctx) {
+	struct epoll_loop_t *loop = (struct epoll_loop_t*)vctx;
+	struct epoll_event events[EPOLL_SERVER_MAX_EVENTS];
+	double next_expiry_check = now() + 1;
+
+	while (true) {
+		int event_count = epoll_wait(loop->epoll_fd, events, EPOLL_SERVER_MAX_EVENTS, 1000);
+		if (event_count == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			log_libc(LLVL_FATAL, "Event loop %u failed in epoll_wait(2)", loop->loop_id);
+			break;
+		}
+
+		for (int i = 0; i < event_count; i++) {
+			struct epoll_connection_t *conn = (struct epoll_connection_t*)events[i].data.ptr;
+			if (!conn) {
+				/* Listening socket */
+				epoll_loop_accept(loop);
+			} else if (events[i].data.ptr == &epoll_wakeup_marker) {
+				epoll_loop_resume_connections(loop);
+			} else {
+				epoll_connection_advance(loop, conn);
+			}
+		}
+
+		if (now() >= next_expiry_check) {
+			epoll_loop_expire_connections(loop);
+			next_expiry_check = now() + 1;
+		}
+	}
+	return NULL;
+}
+
+static unsigned int epoll_server_thread_count(const struct epoll_server_config_t *config) {
+	if (config->thread_count) {
+		return config->thread_count;
+	}
+	long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+	return (cpu_count > 0) ? cpu_count : 1;
+}
+
+bool epoll_server_run(const struct epoll_server_config_t *config) {
+	for (unsigned int i = 0; i < config->listen_sd_count; i++) {
+		if (!set_nonblocking(config->listen_sds[i])) {
+			log_libc(LLVL_ERROR, "Unable to set listening socket non-blocking");
+			return false;
+		}
+	}
+
+	unsigned int thread_count = epoll_server_thread_count(config);
+	if (thread_count < config->listen_sd_count) {
+		/* Every listening socket needs an event loop or the connections the
+		 * kernel assigns to it would never be accepted */
+		thread_count = config->listen_sd_count;
+	}
+	struct epoll_loop_t *loops = calloc(thread_count, sizeof(struct epoll_loop_t));
+	if (!loops) {
+		log_libc(LLVL_FATAL, "Unable to calloc(3) event loops");
+		return false;
+	}
+
+	bool success = true;
+	for (unsigned int i = 0; i < thread_count; i++) {
+		struct epoll_loop_t *loop = &loops[i];
+		loop->config = config;
+		loop->loop_id = i;
+		loop->listen_sd = config->listen_sds[i % config->listen_sd_count];
+		loop->wakeup_fd = -1;
+		loop->epoll_fd = epoll_create1(0);
+		if (loop->epoll_fd == -1) {
+			log_libc(LLVL_FATAL, "Unable to create epoll_create1(2) instance for event loop %u", i);
+			success = false;
+			break;
+		}
+
+		pthread_mutex_init(&loop->resume_mutex, NULL);
+		loop->wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (loop->wakeup_fd == -1) {
+			log_libc(LLVL_FATAL, "Unable to create eventfd(2) for event loop %u", i);
+			success = false;
+			break;
+		}
+		struct epoll_event wakeup_event = {
+			.events = EPOLLIN,
+			.data.ptr = &epoll_wakeup_marker,
+		};
+		if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->wakeup_fd, &wakeup_event) == -1) {
+			log_libc(LLVL_FATAL, "Unable to register wakeup eventfd with event loop %u", i);
+			success = false;
+			break;
+		}
+
+		/* Loops that share the same listening socket are registered with
+		 * EPOLLEXCLUSIVE so only one of them is woken up per incoming
+		 * connection. */
+		struct epoll_event event = {
+			.events = EPOLLIN | EPOLLEXCLUSIVE,
+			.data.ptr = NULL,
+		};
+		if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->listen_sd, &event) == -1) {
+			log_libc(LLVL_FATAL, "Unable to register listening socket with event loop %u", i);
+			success = false;
+			break;
+		}
+
+		if (pthread_create(&loop->thread, NULL, epoll_loop_thread, loop)) {
+			log_libc(LLVL_FATAL, "Unable to pthread_create(3) event loop %u", i);
+			success = false;
+			break;
+		}
+		loop->thread_running = true;
+	}
+
+	if (success) {
+		log_msg(LLVL_DEBUG, "Serving clients from %u event loop threads on %u listening sockets.", thread_count, config->listen_sd_count);
+	}
+
+	for (unsigned int i = 0; i < thread_count; i++) {
+		struct epoll_loop_t *loop = &loops[i];
+		if (loop->thread_running) {
+			if (!success) {
+				pthread_cancel(loop->thread);
+			}
+			pthread_join(loop->thread, NULL);
+			/* An event loop only ever terminates on fatal error */
+			success = false;
+		}
+	}
+	for (unsigned int i = 0; i < thread_count; i++) {
+		if (loops[i].epoll_fd > 0) {
+			close(loops[i].epoll_fd);
+		}
+		if (loops[i].wakeup_fd > 0) {
+			close(loops[i].wakeup_fd);
+			pthread_mutex_destroy(&loops[i].resume_mutex);
+		}
+	}
+	free(loops);
+	return success;
+}
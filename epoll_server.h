@@ -0,0 +1,75 @@
+/*
+	luksrku - Tool to remotely unlock LUKS disks using TLS.
+	Copyright (C) 2016-2026 Johannes Bauer
+
+	This file is part of luksrku.
+
+	luksrku is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; this program is ONLY licensed under
+	version 3 of the License, later versions are explicitly excluded.
+
+	luksrku is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with luksrku; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+	Johannes Bauer <JohannesBauer@gmx.de>
+*/
+
+#ifndef __EPOLL_SERVER_H__
+#define __EPOLL_SERVER_H__
+
+#include <stdbool.h>
+#include <openssl/ssl.h>
+
+/* Maximum number of events that are processed per epoll_wait(2) call */
+#define EPOLL_SERVER_MAX_EVENTS						64
+
+/* Time after which a client that has not completed handshake and transfer is
+ * forcibly disconnected */
+#define EPOLL_SERVER_CONNECTION_TIMEOUT_MILLIS		10000
+
+struct epoll_connection_t;
+
+struct epoll_server_callbacks_t {
+	/* Called for every accepted client. Returns the connection context (which
+	 * is also set as SSL application data) or NULL to reject the client. The
+	 * connection handle is needed to resume a parked handshake. */
+	void* (*connection_open)(void *server_ctx, int fd, struct epoll_connection_t *conn);
+
+	/* Called once the TLS handshake completed. Sets the payload that is
+	 * transmitted to the client before the connection is closed. The payload
+	 * is owned by the connection context. */
+	bool (*connection_established)(void *connection_ctx, SSL *ssl, const void **txdata, unsigned int *txlength);
+
+	/* Called when a connection is torn down, regardless of outcome. */
+	void (*connection_close)(void *connection_ctx);
+};
+
+struct epoll_server_config_t {
+	SSL_CTX *ssl_ctx;
+	/* Listening sockets are distributed round-robin among the event loops */
+	const int *listen_sds;
+	unsigned int listen_sd_count;
+	unsigned int thread_count;
+	void *server_ctx;
+	struct epoll_server_callbacks_t callbacks;
+};
+
+/* A ClientHello callback may return SSL_CLIENT_HELLO_RETRY to park the
+ * handshake while it waits for data from another thread. The event loop then
+ * serves other connections until epoll_server_resume() is called, which must
+ * happen exactly once for every parked handshake. Until then, the connection
+ * and its context are kept alive even if it times out. */
+
+/*************** AUTO GENERATED SECTION FOLLOWS ***************/
+void epoll_server_resume(struct epoll_connection_t *conn);
+bool epoll_server_run(const struct epoll_server_config_t *config);
+/***************  AUTO GENERATED SECTION ENDS   ***************/
+
+#endif
@@ -21,6 +21,7 @@
 	Johannes Bauer <JohannesBauer@gmx.de>
 */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -29,6 +30,7 @@
 #include <string.h>
 #include <stdint.h>
 #include <errno.h>
+#include <fcntl.h>
 
 #include "exec.h"
 #include "log.h"
@@ -85,9 +87,11 @@ struct exec_result_t exec_command(const struct exec_cmd_t *command) {
 		return (struct exec_result_t) { .success = false };
 	}
 
+	/* Close-on-exec so that commands which are run concurrently from other
+	 * threads do not inherit our write end and never see EOF on stdin */
 	int pipefd[2];
-	if (pipe(pipefd) == -1) {
-		log_libc(LLVL_ERROR, "Creation of pipe(2) failed trying to execute %s", argvcopy[0]);
+	if (pipe2(pipefd, O_CLOEXEC) == -1) {
+		log_libc(LLVL_ERROR, "Creation of pipe2(2) failed trying to execute %s", argvcopy[0]);
 		argv_free(argvcopy);
 		return (struct exec_result_t) { .success = false };
 	}
@@ -97,6 +101,8 @@ struct exec_result_t exec_command(const struct exec_cmd_t *command) {
 	pid_t pid = fork();
 	if (pid == -1) {
 		perror("fork");
+		close(pipe_read_end);
+		close(pipe_write_end);
 		argv_free(argvcopy);
 		return (struct exec_result_t) { .success = false };
 	}
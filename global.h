@@ -24,10 +24,20 @@
 #ifndef __GLOBAL_H__
 #define __GLOBAL_H__
 
-/* Blacklisting timeouts in seconds */
-#define BLACKLIST_TIMEOUT_CLIENT							3600
+/* Blacklisting timeout in seconds */
 #define BLACKLIST_TIMEOUT_SERVER							15
 
+/* Number of addresses the server's blacklist can hold per host in the
+ * database, as hosts may send discovery queries from several addresses */
+#define BLACKLIST_ENTRIES_PER_HOST							4
+
+/* Client-side retry intervals for keyservers in seconds: transient failures
+ * are retried with exponential backoff between minimum and maximum, servers
+ * which do not serve the host are avoided for much longer */
+#define KEYSERVER_RETRY_MIN_SECS							2
+#define KEYSERVER_RETRY_MAX_SECS							60
+#define KEYSERVER_RETRY_UNSERVED_SECS						3600
+
 /* Size in bytes of the PSK that is used for TLS */
 #define PSK_SIZE_BYTES										32
 
@@ -46,13 +56,31 @@
 /* How long a passphrase is in it's encoded form, storing it as a character array */
 #define LUKS_PASSPHRASE_TEXT_SIZE_BYTES							((((LUKS_PASSPHRASE_RAW_SIZE_BYTES + 2) / 3) * 4) + 1)
 
+/* How long a LUKS volume key may be at most (512 bit, e.g., AES-256 in XTS mode) */
+#define LUKS_VOLUME_KEY_MAX_SIZE_BYTES						64
+
 /* Number of characters a user-defined passphrase may be long */
 #define MAX_PASSPHRASE_LENGTH								256
 
 /* Number of characters a database filename can be long */
 #define MAX_FILENAME_LENGTH									256
 
-/* In what interval the server should broadcast that it's waiting for unlocking */
+/* In what interval the worker pool engine logs its queue statistics */
+#define KEYSERVER_POOL_STATS_INTERVAL_SECS					60
+
+/* Receive and send timeout of client sockets handled by the worker pool
+ * engine, so that idle clients cannot occupy the workers indefinitely */
+#define KEYSERVER_POOL_SOCKET_TIMEOUT_MILLIS				10000
+
+/* In what interval the keyserver logs how many discovery datagrams it
+ * received and dropped, if any arrived */
+#define KEYSERVER_UDP_STATS_INTERVAL_SECS					60
+
+/* How many keyserver addresses a client tries at once, either answers to a
+ * discovery broadcast or resolved addresses of the given keyservers */
+#define KEYSERVER_MAX_CANDIDATES							16
+
+/* In what interval the client should broadcast that it's waiting for unlocking */
 #define WAITING_MESSAGE_BROADCAST_INTERVAL_MILLISECONDS		1000
 
 #define staticassert(cond)		_Static_assert((cond), #cond)
@@ -0,0 +1,179 @@
+/*
+	luksrku - Tool to remotely unlock LUKS disks using TLS.
+	Copyright (C) 2016-2026 Johannes Bauer
+
+	This file is part of luksrku.
+
+	luksrku is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; this program is ONLY licensed under
+	version 3 of the License, later versions are explicitly excluded.
+
+	luksrku is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with luksrku; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+	Johannes Bauer <JohannesBauer@gmx.de>
+*/
+
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "ipaddr.h"
+#include "log.h"
+
+socklen_t sockaddr_length(const struct sockaddr_storage *address) {
+	return (address->ss_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+}
+
+void sockaddr_set_port(struct sockaddr_storage *address, unsigned int port) {
+	if (address->ss_family == AF_INET6) {
+		((struct sockaddr_in6*)address)->sin6_port = htons(port);
+	} else {
+		((struct sockaddr_in*)address)->sin_port = htons(port);
+	}
+}
+
+unsigned int sockaddr_get_port(const struct sockaddr_storage *address) {
+	if (address->ss_family == AF_INET6) {
+		return ntohs(((const struct sockaddr_in6*)address)->sin6_port);
+	} else {
+		return ntohs(((const struct sockaddr_in*)address)->sin_port);
+	}
+}
+
+/* Dual-stack sockets report IPv4 peers as IPv4-mapped IPv6 addresses; convert
+ * those to plain IPv4 addresses. */
+void sockaddr_unmap_ipv4(struct sockaddr_storage *address) {
+	if (address->ss_family != AF_INET6) {
+		return;
+	}
+	const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6*)address;
+	if (!IN6_IS_ADDR_V4MAPPED(&sin6->sin6_addr)) {
+		return;
+	}
+	struct sockaddr_in sin = {
+		.sin_family = AF_INET,
+		.sin_port = sin6->sin6_port,
+	};
+	memcpy(&sin.sin_addr, &sin6->sin6_addr.s6_addr[12], 4);
+	memset(address, 0, sizeof(*address));
+	memcpy(address, &sin, sizeof(sin));
+}
+
+/* Converts a plain IPv4 address so that it can be used with a dual-stack
+ * socket. */
+void sockaddr_map_ipv4(struct sockaddr_storage *address) {
+	if (address->ss_family != AF_INET) {
+		return;
+	}
+	const struct sockaddr_in sin = *((const struct sockaddr_in*)address);
+	struct sockaddr_in6 sin6 = {
+		.sin6_family = AF_INET6,
+		.sin6_port = sin.sin_port,
+	};
+	sin6.sin6_addr.s6_addr[10] = 0xff;
+	sin6.sin6_addr.s6_addr[11] = 0xff;
+	memcpy(&sin6.sin6_addr.s6_addr[12], &sin.sin_addr, 4);
+	memset(address, 0, sizeof(*address));
+	memcpy(address, &sin6, sizeof(sin6));
+}
+
+void ip_address_from_sockaddr(struct ip_address_t *ip, const struct sockaddr_storage *address) {
+	struct sockaddr_storage mapped = *address;
+	sockaddr_map_ipv4(&mapped);
+	const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6*)&mapped;
+	memcpy(ip->bytes, &sin6->sin6_addr, sizeof(ip->bytes));
+	const bool link_local = IN6_IS_ADDR_LINKLOCAL(&sin6->sin6_addr) || IN6_IS_ADDR_MC_LINKLOCAL(&sin6->sin6_addr);
+	ip->scope_id = link_local ? sin6->sin6_scope_id : 0;
+}
+
+bool ip_address_equal(const struct ip_address_t *a, const struct ip_address_t *b) {
+	return !memcmp(a->bytes, b->bytes, sizeof(a->bytes)) && (a->scope_id == b->scope_id);
+}
+
+/* Compares only the host part, i.e., ignores ports */
+bool sockaddr_same_host(const struct sockaddr_storage *a, const struct sockaddr_storage *b) {
+	struct ip_address_t ip_a, ip_b;
+	ip_address_from_sockaddr(&ip_a, a);
+	ip_address_from_sockaddr(&ip_b, b);
+	return ip_address_equal(&ip_a, &ip_b);
+}
+
+void sprintf_sockaddr(char *buffer, const struct sockaddr_storage *address) {
+	struct sockaddr_storage unmapped = *address;
+	sockaddr_unmap_ipv4(&unmapped);
+	buffer[0] = 0;
+	if (unmapped.ss_family == AF_INET) {
+		inet_ntop(AF_INET, &((const struct sockaddr_in*)&unmapped)->sin_addr, buffer, IP_ADDRESS_BUFSIZE);
+	} else if (unmapped.ss_family == AF_INET6) {
+		const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6*)&unmapped;
+		inet_ntop(AF_INET6, &sin6->sin6_addr, buffer, IP_ADDRESS_BUFSIZE);
+		char interface[IF_NAMESIZE];
+		if (sin6->sin6_scope_id && if_indextoname(sin6->sin6_scope_id, interface)) {
+			strcat(buffer, "%");
+			strcat(buffer, interface);
+		}
+	} else {
+		strcpy(buffer, "?");
+	}
+}
+
+/* Creates an IPv6 socket that also serves IPv4 through IPv4-mapped addresses.
+ * On hosts without IPv6 support, falls back to a plain IPv4 socket. */
+int create_dual_stack_socket(int type) {
+	int sd = socket(AF_INET6, type, 0);
+	if (sd == -1) {
+		if (errno != EAFNOSUPPORT) {
+			log_libc(LLVL_ERROR, "Unable to create IPv6 socket(2)");
+			return -1;
+		}
+		log_msg(LLVL_DEBUG, "IPv6 not supported, falling back to IPv4.");
+		sd = socket(AF_INET, type, 0);
+		if (sd == -1) {
+			log_libc(LLVL_ERROR, "Unable to create IPv4 socket(2)");
+		}
+		return sd;
+	}
+
+	int value = 0;
+	if (setsockopt(sd, IPPROTO_IPV6, IPV6_V6ONLY, &value, sizeof(value))) {
+		log_libc(LLVL_ERROR, "Unable to make IPv6 socket dual-stack using setsockopt(2)");
+		close(sd);
+		return -1;
+	}
+	return sd;
+}
+
+/* Binds a socket created by create_dual_stack_socket() to the given port on
+ * all addresses. */
+bool bind_wildcard_address(int sd, unsigned int port) {
+	struct sockaddr_storage address;
+	socklen_t address_length = sizeof(address);
+	if (getsockname(sd, (struct sockaddr*)&address, &address_length)) {
+		log_libc(LLVL_ERROR, "Unable to determine socket address family using getsockname(2)");
+		return false;
+	}
+
+	const sa_family_t family = address.ss_family;
+	memset(&address, 0, sizeof(address));
+	address.ss_family = family;
+	if (family == AF_INET6) {
+		((struct sockaddr_in6*)&address)->sin6_addr = in6addr_any;
+	} else {
+		((struct sockaddr_in*)&address)->sin_addr.s_addr = htonl(INADDR_ANY);
+	}
+	sockaddr_set_port(&address, port);
+	if (bind(sd, (struct sockaddr*)&address, sockaddr_length(&address)) == -1) {
+		log_libc(LLVL_ERROR, "Unable to bind(2) socket to port %u", port);
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,62 @@
+/*
+	luksrku - Tool to remotely unlock LUKS disks using TLS.
+	Copyright (C) 2016-2026 Johannes Bauer
+
+	This file is part of luksrku.
+
+	luksrku is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; this program is ONLY licensed under
+	version 3 of the License, later versions are explicitly excluded.
+
+	luksrku is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with luksrku; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+	Johannes Bauer <JohannesBauer@gmx.de>
+*/
+
+
+#ifndef __IPADDR_H__
+#define __IPADDR_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+
+/* Printable host address including a possible IPv6 zone, e.g.,
+ * "fe80::1%eth0"; already includes zero termination */
+#define IP_ADDRESS_BUFSIZE			(INET6_ADDRSTRLEN + IF_NAMESIZE + 1)
+
+/* Host address of either family in a form suitable as a lookup key. IPv4
+ * addresses are stored as IPv4-mapped IPv6 addresses. Link-local addresses
+ * are only unique per interface, so they carry their scope; it is zero for
+ * all other addresses. */
+struct ip_address_t {
+	uint8_t bytes[16];
+	uint32_t scope_id;
+};
+
+/*************** AUTO GENERATED SECTION FOLLOWS ***************/
+socklen_t sockaddr_length(const struct sockaddr_storage *address);
+void sockaddr_set_port(struct sockaddr_storage *address, unsigned int port);
+unsigned int sockaddr_get_port(const struct sockaddr_storage *address);
+void sockaddr_unmap_ipv4(struct sockaddr_storage *address);
+void sockaddr_map_ipv4(struct sockaddr_storage *address);
+void ip_address_from_sockaddr(struct ip_address_t *ip, const struct sockaddr_storage *address);
+bool ip_address_equal(const struct ip_address_t *a, const struct ip_address_t *b);
+bool sockaddr_same_host(const struct sockaddr_storage *a, const struct sockaddr_storage *b);
+void sprintf_sockaddr(char *buffer, const struct sockaddr_storage *address);
+int create_dual_stack_socket(int type);
+bool bind_wildcard_address(int sd, unsigned int port);
+/***************  AUTO GENERATED SECTION ENDS   ***************/
+
+#endif
@@ -33,6 +33,14 @@
 #include "uuid.h"
 #include "log.h"
 
+static unsigned int keydb_getsize_v4_hostcount(unsigned int host_count) {
+	return sizeof(struct keydb_v4_t) + (host_count * sizeof(struct host_entry_v4_t));
+}
+
+static unsigned int keydb_getsize_v4(const struct keydb_v4_t *keydb) {
+	return keydb_getsize_v4_hostcount(keydb->host_count);
+}
+
 static unsigned int keydb_getsize_v3_hostcount(unsigned int host_count) {
 	return sizeof(struct keydb_v3_t) + (host_count * sizeof(struct host_entry_v3_t));
 }
@@ -50,11 +58,11 @@ static unsigned int keydb_getsize_v2(const struct keydb_v2_t *keydb) {
 }
 
 static unsigned int keydb_getsize_hostcount(unsigned int host_count) {
-	return keydb_getsize_v3_hostcount(host_count);
+	return keydb_getsize_v4_hostcount(host_count);
 }
 
 static unsigned int keydb_getsize(const keydb_t *keydb) {
-	return keydb_getsize_v3(keydb);
+	return keydb_getsize_v4(keydb);
 }
 
 keydb_t* keydb_new(void) {
@@ -80,10 +88,13 @@ keydb_t* keydb_export_public(host_entry_t *host) {
 	host_entry_t *public_host = &public_db->hosts[0];
 	*public_host = *host;
 
-	/* But remove all LUKS passphrases of course, this is for the luksrku client */
+	/* But remove all LUKS passphrases and volume keys of course, this is for
+	 * the luksrku client */
 	for (unsigned int i = 0; i < host->volume_count; i++) {
 		volume_entry_t *volume = &public_host->volumes[i];
 		memset(volume->luks_passphrase_raw, 0, sizeof(volume->luks_passphrase_raw));
+		memset(volume->luks_volume_key, 0, sizeof(volume->luks_volume_key));
+		volume->luks_volume_key_length = 0;
 	}
 
 	return public_db;
@@ -267,6 +278,17 @@ bool keydb_get_volume_luks_passphrase(const volume_entry_t *volume, char *dest,
 	return ascii_encode(dest, dest_buffer_size, volume->luks_passphrase_raw, sizeof(volume->luks_passphrase_raw));
 }
 
+bool keydb_set_volume_key(volume_entry_t *volume, const uint8_t *volume_key, unsigned int volume_key_length) {
+	if (volume_key_length > sizeof(volume->luks_volume_key)) {
+		log_msg(LLVL_ERROR, "LUKS volume key of %u bytes exceeds maximum of %zu bytes.", volume_key_length, sizeof(volume->luks_volume_key));
+		return false;
+	}
+	OPENSSL_cleanse(volume->luks_volume_key, sizeof(volume->luks_volume_key));
+	memcpy(volume->luks_volume_key, volume_key, volume_key_length);
+	volume->luks_volume_key_length = volume_key_length;
+	return true;
+}
+
 bool keydb_write(const keydb_t *keydb, const char *filename, const char *passphrase) {
 	enum kdf_t kdf;
 	if ((!passphrase) || (strlen(passphrase) == 0)) {
@@ -314,6 +336,38 @@ static bool keydb_migrate_v2_to_v3(void **keydb_data, unsigned int *keydb_data_s
 	return true;
 }
 
+static bool keydb_migrate_v3_to_v4(void **keydb_data, unsigned int *keydb_data_size) {
+	log_msg(LLVL_INFO, "Migrating keydb version 3 to version 4");
+	struct keydb_v3_t *old_db = *((struct keydb_v3_t **)keydb_data);
+	unsigned int new_db_size = keydb_getsize_v4_hostcount(old_db->host_count);
+	struct keydb_v4_t *new_db = calloc(1, new_db_size);
+	if (!new_db) {
+		log_msg(LLVL_ERROR, "keydb migration failed to allocate %d bytes of memory", new_db_size);
+		return false;
+	}
+
+	*new_db = (struct keydb_v4_t) {
+		.common.keydb_version = 4,
+		.server_database = old_db->server_database,
+		.host_count = old_db->host_count,
+	};
+	for (unsigned int i = 0; i < new_db->host_count; i++) {
+		/* Do not copy over volumes */
+		memcpy(&new_db->hosts[i], &old_db->hosts[i], sizeof(old_db->hosts[i]) - sizeof(old_db->hosts[i].volumes));
+		for (unsigned int j = 0; j < new_db->hosts[i].volume_count; j++) {
+			/* Do not copy over volume key */
+			memcpy(&new_db->hosts[i].volumes[j], &old_db->hosts[i].volumes[j], sizeof(old_db->hosts[i].volumes[j]));
+		}
+	}
+
+	OPENSSL_cleanse(old_db, *keydb_data_size);
+	free(old_db);
+
+	*keydb_data = new_db;
+	*keydb_data_size = new_db_size;
+	return true;
+}
+
 static keydb_t* keydb_migrate(void **keydb_data, unsigned int *keydb_data_size) {
 	struct keydb_common_header_t *header;
 
@@ -335,6 +389,18 @@ static keydb_t* keydb_migrate(void **keydb_data, unsigned int *keydb_data_size)
 			log_msg(LLVL_ERROR, "keydb version 3 has wrong size (%u bytes, but expected %u bytes).", *keydb_data_size, keydb_getsize_v3(*keydb_data));
 			return NULL;
 		}
+		if (!keydb_migrate_v3_to_v4(keydb_data, keydb_data_size)) {
+			log_msg(LLVL_ERROR, "keydb version 3 to 4 migration failed.");
+			return NULL;
+		}
+	}
+
+	header = *((struct keydb_common_header_t**)keydb_data);
+	if (header->keydb_version == 4) {
+		if (*keydb_data_size != keydb_getsize_v4(*keydb_data)) {
+			log_msg(LLVL_ERROR, "keydb version 4 has wrong size (%u bytes, but expected %u bytes).", *keydb_data_size, keydb_getsize_v4(*keydb_data));
+			return NULL;
+		}
 	}
 
 	header = *((struct keydb_common_header_t**)keydb_data);
@@ -34,6 +34,7 @@
 
 enum volume_flag_t {
 	VOLUME_FLAG_ALLOW_DISCARDS = (1 << 0),
+	VOLUME_FLAG_DELIVER_VOLUME_KEY = (1 << 1),
 };
 
 /* Unused so far */
@@ -90,11 +91,37 @@ struct keydb_v3_t {
 	struct host_entry_v3_t hosts[];
 } ALIGNED;
 
+struct volume_entry_v4_t {
+	uint8_t volume_uuid[16];										/* UUID of crypt_LUKS volume */
+	char devmapper_name[MAX_DEVMAPPER_NAME_LENGTH];					/* dmsetup name when unlocked. Zero-terminated string. */
+	uint8_t luks_passphrase_raw[LUKS_PASSPHRASE_RAW_SIZE_BYTES];	/* LUKS passphrase used to unlock volume; raw byte data */
+	unsigned int volume_flags;										/* Bitset of enum volume_flag_t */
+	unsigned int luks_volume_key_length;							/* Length of the LUKS volume key in bytes, zero if none imported */
+	uint8_t luks_volume_key[LUKS_VOLUME_KEY_MAX_SIZE_BYTES];		/* LUKS volume key that bypasses the keyslot KDF; raw byte data */
+} ALIGNED;
+
+struct host_entry_v4_t {
+	uint8_t host_uuid[16];											/* Host UUID */
+	char host_name[MAX_HOST_NAME_LENGTH];							/* Descriptive name of host */
+	uint8_t tls_psk[PSK_SIZE_BYTES];								/* Raw byte data of TLS-PSK that is used */
+	unsigned int volume_count;										/* Number of volumes of this host */
+	unsigned int client_default_timeout_secs;						/* Client gives up by default if not everything unlocked after this time */
+	unsigned int host_flags;										/* Bitset of enum host_flag_t */
+	struct volume_entry_v4_t volumes[MAX_VOLUMES_PER_HOST];			/* Volumes of this host */
+} ALIGNED;
+
+struct keydb_v4_t {
+	struct keydb_common_header_t common;
+	bool server_database;
+	unsigned int host_count;
+	struct host_entry_v4_t hosts[];
+} ALIGNED;
+
 
-#define KEYDB_CURRENT_VERSION						3
-typedef struct volume_entry_v3_t volume_entry_t;
-typedef struct host_entry_v3_t host_entry_t;
-typedef struct keydb_v3_t keydb_t;
+#define KEYDB_CURRENT_VERSION						4
+typedef struct volume_entry_v4_t volume_entry_t;
+typedef struct host_entry_v4_t host_entry_t;
+typedef struct keydb_v4_t keydb_t;
 
 
 /*************** AUTO GENERATED SECTION FOLLOWS ***************/
@@ -114,6 +141,7 @@ volume_entry_t* keydb_add_volume(host_entry_t *host, const char *devmapper_name,
 bool keydb_del_volume(host_entry_t *host, const char *devmapper_name);
 bool keydb_rekey_volume(volume_entry_t *volume);
 bool keydb_get_volume_luks_passphrase(const volume_entry_t *volume, char *dest, unsigned int dest_buffer_size);
+bool keydb_set_volume_key(volume_entry_t *volume, const uint8_t *volume_key, unsigned int volume_key_length);
 bool keydb_write(const keydb_t *keydb, const char *filename, const char *passphrase);
 keydb_t* keydb_read(const char *filename);
 /***************  AUTO GENERATED SECTION ENDS   ***************/
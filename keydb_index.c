@@ -0,0 +1,118 @@
+/*
+	luksrku - Tool to remotely unlock LUKS disks using TLS.
+	Copyright (C) 2016-2026 Johannes Bauer
+
+	This file is part of luksrku.
+
+	luksrku is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; this program is ONLY licensed under
+	version 3 of the License, later versions are explicitly excluded.
+
+	luksrku is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with luksrku; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+	Johannes Bauer <JohannesBauer@gmx.de>
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "keydb_index.h"
+#include "log.h"
+
+static unsigned int keydb_index_hash(const uint8_t uuid[static 16]) {
+	/* UUIDs are mostly random already, but they are not guaranteed to be
+	 * (e.g., when they're imported), so mix all bits anyways */
+	uint64_t lo, hi;
+	memcpy(&lo, uuid + 0, sizeof(lo));
+	memcpy(&hi, uuid + 8, sizeof(hi));
+	uint64_t hash = lo ^ (hi * 0x9e3779b97f4a7c15ULL);
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdULL;
+	hash ^= hash >> 33;
+	hash *= 0xc4ceb9fe1a85ec53ULL;
+	hash ^= hash >> 33;
+	return hash;
+}
+
+/* Must be called whenever the host entries of the key database change,
+ * including when the keydb itself was reallocated. */
+bool keydb_index_rebuild(struct keydb_index_t *index, const keydb_t *keydb) {
+	/* Keep the load factor at or below 50% */
+	unsigned int slot_count = 16;
+	while (slot_count < 2 * keydb->host_count) {
+		slot_count *= 2;
+	}
+
+	struct keydb_index_slot_t *slots = malloc(sizeof(struct keydb_index_slot_t) * slot_count);
+	if (!slots) {
+		log_libc(LLVL_ERROR, "Unable to malloc(3) keydb index of %u slots", slot_count);
+		return false;
+	}
+	for (unsigned int i = 0; i < slot_count; i++) {
+		slots[i].host_index = KEYDB_INDEX_EMPTY_SLOT;
+	}
+
+	const unsigned int slot_mask = slot_count - 1;
+	for (unsigned int i = 0; i < keydb->host_count; i++) {
+		const host_entry_t *host = &keydb->hosts[i];
+		unsigned int slot_index = keydb_index_hash(host->host_uuid) & slot_mask;
+		while (slots[slot_index].host_index != KEYDB_INDEX_EMPTY_SLOT) {
+			if (!memcmp(slots[slot_index].host_uuid, host->host_uuid, 16)) {
+				/* Duplicate UUID, first host entry wins just like with a
+				 * linear search */
+				break;
+			}
+			slot_index = (slot_index + 1) & slot_mask;
+		}
+		if (slots[slot_index].host_index == KEYDB_INDEX_EMPTY_SLOT) {
+			memcpy(slots[slot_index].host_uuid, host->host_uuid, 16);
+			slots[slot_index].host_index = i;
+		}
+	}
+
+	free(index->slots);
+	index->keydb = keydb;
+	index->slot_mask = slot_mask;
+	index->slots = slots;
+	return true;
+}
+
+struct keydb_index_t *keydb_index_new(const keydb_t *keydb) {
+	struct keydb_index_t *index = calloc(1, sizeof(struct keydb_index_t));
+	if (!index) {
+		log_libc(LLVL_ERROR, "Unable to calloc(3) keydb index");
+		return NULL;
+	}
+	if (!keydb_index_rebuild(index, keydb)) {
+		free(index);
+		return NULL;
+	}
+	log_msg(LLVL_DEBUG, "Built keydb UUID index with %u slots for %u hosts.", index->slot_mask + 1, keydb->host_count);
+	return index;
+}
+
+const host_entry_t* keydb_index_get_host_by_uuid(const struct keydb_index_t *index, const uint8_t uuid[static 16]) {
+	unsigned int slot_index = keydb_index_hash(uuid) & index->slot_mask;
+	while (index->slots[slot_index].host_index != KEYDB_INDEX_EMPTY_SLOT) {
+		if (!memcmp(index->slots[slot_index].host_uuid, uuid, 16)) {
+			return &index->keydb->hosts[index->slots[slot_index].host_index];
+		}
+		slot_index = (slot_index + 1) & index->slot_mask;
+	}
+	return NULL;
+}
+
+void keydb_index_free(struct keydb_index_t *index) {
+	if (!index) {
+		return;
+	}
+	free(index->slots);
+	free(index);
+}
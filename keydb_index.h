@@ -0,0 +1,53 @@
+/*
+	luksrku - Tool to remotely unlock LUKS disks using TLS.
+	Copyright (C) 2016-2026 Johannes Bauer
+
+	This file is part of luksrku.
+
+	luksrku is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; this program is ONLY licensed under
+	version 3 of the License, later versions are explicitly excluded.
+
+	luksrku is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with luksrku; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+	Johannes Bauer <JohannesBauer@gmx.de>
+*/
+
+#ifndef __KEYDB_INDEX_H__
+#define __KEYDB_INDEX_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "keydb.h"
+
+#define KEYDB_INDEX_EMPTY_SLOT			UINT32_MAX
+
+/* Each slot carries a copy of the host UUID so that probing never needs to
+ * touch the (large) host entries themselves */
+struct keydb_index_slot_t {
+	uint8_t host_uuid[16];
+	uint32_t host_index;
+};
+
+struct keydb_index_t {
+	const keydb_t *keydb;
+	unsigned int slot_mask;
+	struct keydb_index_slot_t *slots;
+};
+
+/*************** AUTO GENERATED SECTION FOLLOWS ***************/
+bool keydb_index_rebuild(struct keydb_index_t *index, const keydb_t *keydb);
+struct keydb_index_t *keydb_index_new(const keydb_t *keydb);
+const host_entry_t* keydb_index_get_host_by_uuid(const struct keydb_index_t *index, const uint8_t uuid[static 16]);
+void keydb_index_free(struct keydb_index_t *index);
+/***************  AUTO GENERATED SECTION ENDS   ***************/
+
+#endif
@@ -0,0 +1,129 @@
+/*
+	luksrku - Tool to remotely unlock LUKS disks using TLS.
+	Copyright (C) 2016-2026 Johannes Bauer
+
+	This file is part of luksrku.
+
+	luksrku is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; this program is ONLY licensed under
+	version 3 of the License, later versions are explicitly excluded.
+
+	luksrku is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with luksrku; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+	Johannes Bauer <JohannesBauer@gmx.de>
+*/
+
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "keyserver_health.h"
+#include "global.h"
+#include "util.h"
+
+/* Keeps track of how every keyserver the client talked to behaved. Servers
+ * which failed transiently are retried after a short, exponentially growing
+ * interval, while only those that clearly do not serve this host are avoided
+ * for a long time. */
+
+static struct keyserver_health_entry_t *keyserver_health_get(struct keyserver_health_t *health, const struct ip_address_t *ip) {
+	for (unsigned int i = 0; i < health->entry_count; i++) {
+		if (ip_address_equal(&health->entries[i].ip, ip)) {
+			return &health->entries[i];
+		}
+	}
+
+	struct keyserver_health_entry_t *entry;
+	if (health->entry_count < KEYSERVER_HEALTH_ENTRY_COUNT) {
+		entry = &health->entries[health->entry_count++];
+	} else {
+		/* Table full, evict the server that becomes eligible first */
+		entry = &health->entries[0];
+		for (unsigned int i = 1; i < health->entry_count; i++) {
+			if (health->entries[i].retry_after < entry->retry_after) {
+				entry = &health->entries[i];
+			}
+		}
+	}
+	*entry = (struct keyserver_health_entry_t) {
+		.ip = *ip,
+		.connect_latency = -1,
+	};
+	return entry;
+}
+
+static void keyserver_health_update_latency(struct keyserver_health_entry_t *entry, double connect_time) {
+	if (connect_time < 0) {
+		return;
+	}
+	if (entry->connect_latency < 0) {
+		entry->connect_latency = connect_time;
+	} else {
+		entry->connect_latency = (0.75 * entry->connect_latency) + (0.25 * connect_time);
+	}
+}
+
+const struct keyserver_health_entry_t *keyserver_health_lookup(const struct keyserver_health_t *health, const struct ip_address_t *ip) {
+	for (unsigned int i = 0; i < health->entry_count; i++) {
+		if (ip_address_equal(&health->entries[i].ip, ip)) {
+			return &health->entries[i];
+		}
+	}
+	return NULL;
+}
+
+bool keyserver_health_eligible(const struct keyserver_health_t *health, const struct ip_address_t *ip) {
+	const struct keyserver_health_entry_t *entry = keyserver_health_lookup(health, ip);
+	return !entry || (now() >= entry->retry_after);
+}
+
+/* Connection could not be established or timed out. This is likely transient,
+ * e.g., a server that is still booting itself. */
+void keyserver_health_record_failure(struct keyserver_health_t *health, const struct ip_address_t *ip) {
+	struct keyserver_health_entry_t *entry = keyserver_health_get(health, ip);
+	unsigned int retry_secs = KEYSERVER_RETRY_MIN_SECS;
+	for (unsigned int i = 0; (i < entry->consecutive_failures) && (retry_secs < KEYSERVER_RETRY_MAX_SECS); i++) {
+		retry_secs *= 2;
+	}
+	if (retry_secs > KEYSERVER_RETRY_MAX_SECS) {
+		retry_secs = KEYSERVER_RETRY_MAX_SECS;
+	}
+	entry->consecutive_failures++;
+	entry->retry_after = now() + retry_secs;
+}
+
+/* Server is reachable, but refused the TLS handshake. It does not know our
+ * PSK and therefore does not serve this host. */
+void keyserver_health_record_rejection(struct keyserver_health_t *health, const struct ip_address_t *ip, double connect_time) {
+	struct keyserver_health_entry_t *entry = keyserver_health_get(health, ip);
+	keyserver_health_update_latency(entry, connect_time);
+	entry->consecutive_failures++;
+	entry->retry_after = now() + KEYSERVER_RETRY_UNSERVED_SECS;
+}
+
+/* Handshake completed and the server closed the connection cleanly after
+ * sending keys for the given number of volumes. A server which sent nothing does not serve this host either. If
+ * volumes remain locked, asking the same server again immediately would only
+ * repeat the same answer. */
+void keyserver_health_record_delivery(struct keyserver_health_t *health, const struct ip_address_t *ip, double connect_time, unsigned int volume_count, bool volumes_remain_locked) {
+	struct keyserver_health_entry_t *entry = keyserver_health_get(health, ip);
+	keyserver_health_update_latency(entry, connect_time);
+	entry->handshakes_completed++;
+	entry->volumes_delivered += volume_count;
+	if (volume_count == 0) {
+		entry->consecutive_failures++;
+		entry->retry_after = now() + KEYSERVER_RETRY_UNSERVED_SECS;
+	} else {
+		entry->consecutive_failures = 0;
+		entry->retry_after = now() + (volumes_remain_locked ? KEYSERVER_RETRY_MAX_SECS : 0);
+	}
+}
@@ -0,0 +1,58 @@
+/*
+	luksrku - Tool to remotely unlock LUKS disks using TLS.
+	Copyright (C) 2016-2026 Johannes Bauer
+
+	This file is part of luksrku.
+
+	luksrku is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; this program is ONLY licensed under
+	version 3 of the License, later versions are explicitly excluded.
+
+	luksrku is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with luksrku; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+	Johannes Bauer <JohannesBauer@gmx.de>
+*/
+
+
+#ifndef __KEYSERVER_HEALTH_H__
+#define __KEYSERVER_HEALTH_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "ipaddr.h"
+
+#define KEYSERVER_HEALTH_ENTRY_COUNT						32
+
+struct keyserver_health_entry_t {
+	struct ip_address_t ip;
+	/* Smoothed TCP connect latency in seconds, negative if never connected */
+	double connect_latency;
+	unsigned int handshakes_completed;
+	unsigned int consecutive_failures;
+	unsigned int volumes_delivered;
+	/* Point in time before which the server is not contacted again */
+	double retry_after;
+};
+
+struct keyserver_health_t {
+	struct keyserver_health_entry_t entries[KEYSERVER_HEALTH_ENTRY_COUNT];
+	unsigned int entry_count;
+};
+
+/*************** AUTO GENERATED SECTION FOLLOWS ***************/
+const struct keyserver_health_entry_t *keyserver_health_lookup(const struct keyserver_health_t *health, const struct ip_address_t *ip);
+bool keyserver_health_eligible(const struct keyserver_health_t *health, const struct ip_address_t *ip);
+void keyserver_health_record_failure(struct keyserver_health_t *health, const struct ip_address_t *ip);
+void keyserver_health_record_rejection(struct keyserver_health_t *health, const struct ip_address_t *ip, double connect_time);
+void keyserver_health_record_delivery(struct keyserver_health_t *health, const struct ip_address_t *ip, double connect_time, unsigned int volume_count, bool volumes_remain_locked);
+/***************  AUTO GENERATED SECTION ENDS   ***************/
+
+#endif
@@ -29,6 +29,10 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <dirent.h>
+#ifdef USE_LIBCRYPTSETUP
+#include <libcryptsetup.h>
+#endif
 
 #include "luks.h"
 #include "log.h"
@@ -36,6 +40,92 @@
 #include "util.h"
 #include "uuid.h"
 
+#ifdef USE_LIBCRYPTSETUP
+
+static void luks_log_callback(int level, const char *msg, void *usrptr) {
+	char msgcopy[strlen(msg) + 1];
+	strcpy(msgcopy, msg);
+	truncate_crlf(msgcopy);
+
+	switch (level) {
+		case CRYPT_LOG_ERROR:
+			log_msg(LLVL_ERROR, "libcryptsetup: %s", msgcopy);
+			break;
+
+		case CRYPT_LOG_NORMAL:
+			log_msg(LLVL_DEBUG, "libcryptsetup: %s", msgcopy);
+			break;
+
+		default:
+			log_msg(LLVL_TRACE, "libcryptsetup: %s", msgcopy);
+			break;
+	}
+}
+
+bool is_luks_device_opened(const char *mapping_name) {
+	crypt_status_info status = crypt_status(NULL, mapping_name);
+	return (status == CRYPT_ACTIVE) || (status == CRYPT_BUSY);
+}
+
+static struct crypt_device *luks_load_device(const uint8_t *encrypted_device_uuid, const char *mapping_name) {
+	char encrypted_device[64];
+	strcpy(encrypted_device, "/dev/disk/by-uuid/");
+	sprintf_uuid(encrypted_device + strlen(encrypted_device), encrypted_device_uuid);
+	log_msg(LLVL_INFO, "Trying to unlock LUKS mapping %s based on %s", mapping_name, encrypted_device);
+
+	struct crypt_device *cd = NULL;
+	int result = crypt_init(&cd, encrypted_device);
+	if (result < 0) {
+		log_msg(LLVL_ERROR, "crypt_init() failed for %s: %s (%d)", encrypted_device, strerror(-result), result);
+		return NULL;
+	}
+	crypt_set_log_callback(cd, luks_log_callback, NULL);
+
+	result = crypt_load(cd, CRYPT_LUKS, NULL);
+	if (result < 0) {
+		log_msg(LLVL_ERROR, "crypt_load() failed for %s: %s (%d)", encrypted_device, strerror(-result), result);
+		crypt_free(cd);
+		return NULL;
+	}
+	return cd;
+}
+
+bool open_luks_device(const uint8_t *encrypted_device_uuid, const char *mapping_name, const char *passphrase, unsigned int passphrase_length, bool allow_discards) {
+	struct crypt_device *cd = luks_load_device(encrypted_device_uuid, mapping_name);
+	if (!cd) {
+		return false;
+	}
+
+	uint32_t flags = allow_discards ? CRYPT_ACTIVATE_ALLOW_DISCARDS : 0;
+	int result = crypt_activate_by_passphrase(cd, mapping_name, CRYPT_ANY_SLOT, passphrase, passphrase_length, flags);
+	crypt_free(cd);
+	if (result < 0) {
+		log_msg(LLVL_ERROR, "crypt_activate_by_passphrase() failed for %s: %s (%d)", mapping_name, strerror(-result), result);
+		return false;
+	}
+	log_msg(LLVL_DEBUG, "Activated %s using key slot %d", mapping_name, result);
+	return true;
+}
+
+bool open_luks_device_by_volume_key(const uint8_t *encrypted_device_uuid, const char *mapping_name, const uint8_t *volume_key, unsigned int volume_key_length, bool allow_discards) {
+	struct crypt_device *cd = luks_load_device(encrypted_device_uuid, mapping_name);
+	if (!cd) {
+		return false;
+	}
+
+	uint32_t flags = allow_discards ? CRYPT_ACTIVATE_ALLOW_DISCARDS : 0;
+	int result = crypt_activate_by_volume_key(cd, mapping_name, (const char*)volume_key, volume_key_length, flags);
+	crypt_free(cd);
+	if (result < 0) {
+		log_msg(LLVL_ERROR, "crypt_activate_by_volume_key() failed for %s: %s (%d)", mapping_name, strerror(-result), result);
+		return false;
+	}
+	log_msg(LLVL_DEBUG, "Activated %s using volume key", mapping_name);
+	return true;
+}
+
+#else
+
 bool is_luks_device_opened(const char *mapping_name) {
 	struct exec_cmd_t cmd = {
 		.argv = (const char *[]){
@@ -50,35 +140,95 @@ bool is_luks_device_opened(const char *mapping_name) {
 	return runresult.success && (runresult.returncode == 0);
 }
 
-bool open_luks_device(const uint8_t *encrypted_device_uuid, const char *mapping_name, const char *passphrase, unsigned int passphrase_length, bool allow_discards) {
+static bool luks_exec_open(const uint8_t *encrypted_device_uuid, const char *mapping_name, const void *key_data, unsigned int key_length, bool is_volume_key, bool allow_discards) {
 	char encrypted_device[64];
 	strcpy(encrypted_device, "UUID=");
 	sprintf_uuid(encrypted_device + 5, encrypted_device_uuid);
 	log_msg(LLVL_INFO, "Trying to unlock LUKS mapping %s based on %s", mapping_name, encrypted_device);
 
+	const char *argv[16];
+	unsigned int argc = 0;
+	argv[argc++] = "cryptsetup";
+	if (allow_discards) {
+		argv[argc++] = "--allow-discards";
+	}
+	if (is_volume_key) {
+		/* Key is read from the pipe exactly like the passphrase */
+		argv[argc++] = "--volume-key-file=/dev/stdin";
+	}
+	argv[argc++] = "luksOpen";
+	argv[argc++] = "-T";
+	argv[argc++] = "1";
+	argv[argc++] = encrypted_device;
+	argv[argc++] = mapping_name;
+	argv[argc++] = NULL;
+
 	struct exec_cmd_t cmd = {
-		.argv = !allow_discards ? (const char *[]) {
-			"cryptsetup",
-			"luksOpen",
-			"-T", "1",
-			encrypted_device,
-			mapping_name,
-			NULL,
-		} :
-		(const char *[]) {
-			"cryptsetup",
-			"--allow-discards",
-			"luksOpen",
-			"-T", "1",
-			encrypted_device,
-			mapping_name,
-			NULL,
-		},
-		.stdin_data = passphrase,
-		.stdin_length = passphrase_length,
+		.argv = argv,
+		.stdin_data = key_data,
+		.stdin_length = key_length,
 		.show_output = should_log(LLVL_DEBUG),
 	};
 
 	struct exec_result_t runresult = exec_command(&cmd);
 	return runresult.success && (runresult.returncode == 0);
 }
+
+bool open_luks_device(const uint8_t *encrypted_device_uuid, const char *mapping_name, const char *passphrase, unsigned int passphrase_length, bool allow_discards) {
+	return luks_exec_open(encrypted_device_uuid, mapping_name, passphrase, passphrase_length, false, allow_discards);
+}
+
+bool open_luks_device_by_volume_key(const uint8_t *encrypted_device_uuid, const char *mapping_name, const uint8_t *volume_key, unsigned int volume_key_length, bool allow_discards) {
+	return luks_exec_open(encrypted_device_uuid, mapping_name, volume_key, volume_key_length, true, allow_discards);
+}
+
+#endif
+
+static bool read_dm_name(const char *block_device, char *name, unsigned int name_size) {
+	char filename[320];
+	snprintf(filename, sizeof(filename), "/sys/block/%s/dm/name", block_device);
+	FILE *f = fopen(filename, "r");
+	if (!f) {
+		return false;
+	}
+	bool success = fgets(name, name_size, f) != NULL;
+	fclose(f);
+	if (success) {
+		truncate_crlf(name);
+	}
+	return success;
+}
+
+/* Determines which of the given mappings exist with a single pass over the
+ * device-mapper devices in sysfs. Returns false if sysfs is unavailable, in
+ * which case the result is undefined. */
+bool probe_opened_luks_devices(const char *const *mapping_names, unsigned int mapping_count, bool *opened) {
+	DIR *dir = opendir("/sys/block");
+	if (!dir) {
+		log_libc(LLVL_DEBUG, "Unable to opendir(3) /sys/block");
+		return false;
+	}
+
+	for (unsigned int i = 0; i < mapping_count; i++) {
+		opened[i] = false;
+	}
+
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != NULL) {
+		if (strncmp(entry->d_name, "dm-", 3)) {
+			continue;
+		}
+		char dm_name[128];
+		if (!read_dm_name(entry->d_name, dm_name, sizeof(dm_name))) {
+			continue;
+		}
+		log_msg(LLVL_TRACE, "Found device-mapper device %s: %s", entry->d_name, dm_name);
+		for (unsigned int i = 0; i < mapping_count; i++) {
+			if (!strcmp(mapping_names[i], dm_name)) {
+				opened[i] = true;
+			}
+		}
+	}
+	closedir(dir);
+	return true;
+}
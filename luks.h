@@ -30,6 +30,8 @@
 /*************** AUTO GENERATED SECTION FOLLOWS ***************/
 bool is_luks_device_opened(const char *mapping_name);
 bool open_luks_device(const uint8_t *encrypted_device_uuid, const char *mapping_name, const char *passphrase, unsigned int passphrase_length, bool allow_discards);
+bool open_luks_device_by_volume_key(const uint8_t *encrypted_device_uuid, const char *mapping_name, const uint8_t *volume_key, unsigned int volume_key_length, bool allow_discards);
+bool probe_opened_luks_devices(const char *const *mapping_names, unsigned int mapping_count, bool *opened);
 /***************  AUTO GENERATED SECTION ENDS   ***************/
 
 #endif
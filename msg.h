@@ -49,4 +49,18 @@ struct msg_t {
 
 staticassert(sizeof(struct msg_t) == 16 + LUKS_PASSPHRASE_RAW_SIZE_BYTES);
 
+/* Clients that are able to activate volumes by their volume key offer this
+ * protocol via ALPN. When the server selects it, every message is sent as a
+ * struct msg_volume_key_t instead of a struct msg_t; servers that do not know
+ * about it ignore the extension and keep sending plain messages. */
+#define MSG_ALPN_VOLUME_KEY									"luksrku-vk1"
+
+struct msg_volume_key_t {
+	struct msg_t msg;
+	uint8_t luks_volume_key_length;
+	uint8_t luks_volume_key[LUKS_VOLUME_KEY_MAX_SIZE_BYTES];
+} __attribute__ ((packed));
+
+staticassert(sizeof(struct msg_volume_key_t) == sizeof(struct msg_t) + 1 + LUKS_VOLUME_KEY_MAX_SIZE_BYTES);
+
 #endif
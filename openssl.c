@@ -171,3 +171,52 @@ int openssl_tls13_psk_establish_session(SSL *ssl, const uint8_t *psk, unsigned i
 	}
 	return return_value;
 }
+
+bool openssl_alpn_negotiated(SSL *ssl, const char *protocol) {
+	const unsigned char *selected;
+	unsigned int selected_length;
+	SSL_get0_alpn_selected(ssl, &selected, &selected_length);
+	return (selected_length == strlen(protocol)) && !memcmp(selected, protocol, selected_length);
+}
+
+/* Extracts the PSK identities offered in the pre_shared_key extension of the
+ * ClientHello; must be called from a ClientHello callback. The identities
+ * point into the ClientHello buffer. Returns the number of identities found,
+ * zero if the extension is absent or malformed. */
+unsigned int openssl_client_hello_psk_identities(SSL *ssl, struct openssl_psk_identity_t *identities, unsigned int max_identities) {
+	const unsigned char *ext;
+	size_t ext_length;
+	if (!SSL_client_hello_get0_ext(ssl, TLSEXT_TYPE_psk, &ext, &ext_length)) {
+		return 0;
+	}
+
+	/* struct { opaque identity<1..2^16-1>; uint32 obfuscated_ticket_age; }
+	 * identities<7..2^16-1>, followed by the binders */
+	if (ext_length < 2) {
+		return 0;
+	}
+	const size_t identities_length = (ext[0] << 8) | ext[1];
+	if (identities_length > ext_length - 2) {
+		return 0;
+	}
+
+	const unsigned char *cursor = ext + 2;
+	const unsigned char *end = cursor + identities_length;
+	unsigned int identity_count = 0;
+	while ((cursor < end) && (identity_count < max_identities)) {
+		if (end - cursor < 2) {
+			return 0;
+		}
+		const size_t identity_length = (cursor[0] << 8) | cursor[1];
+		cursor += 2;
+		if ((size_t)(end - cursor) < identity_length + 4) {
+			return 0;
+		}
+		identities[identity_count++] = (struct openssl_psk_identity_t) {
+			.identity = cursor,
+			.length = identity_length,
+		};
+		cursor += identity_length + 4;
+	}
+	return identity_count;
+}
@@ -33,11 +33,18 @@ struct generic_tls_ctx_t {
 	SSL_CTX *ctx;
 };
 
+struct openssl_psk_identity_t {
+	const unsigned char *identity;
+	size_t length;
+};
+
 /*************** AUTO GENERATED SECTION FOLLOWS ***************/
 bool openssl_init(void);
 bool create_generic_tls_context(struct generic_tls_ctx_t *gctx, bool server);
 void free_generic_tls_context(struct generic_tls_ctx_t *gctx);
 int openssl_tls13_psk_establish_session(SSL *ssl, const uint8_t *psk, unsigned int psk_length, const EVP_MD *cipher_md, SSL_SESSION **new_session);
+bool openssl_alpn_negotiated(SSL *ssl, const char *protocol);
+unsigned int openssl_client_hello_psk_identities(SSL *ssl, struct openssl_psk_identity_t *identities, unsigned int max_identities);
 /***************  AUTO GENERATED SECTION ENDS   ***************/
 
 #endif
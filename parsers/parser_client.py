@@ -2,7 +2,12 @@ import argparse
 parser = argparse.ArgumentParser(prog = "luksrku client", description = "Connects to a luksrku key server and unlocks local LUKS volumes.", add_help = False)
 parser.add_argument("-t", "--timeout", metavar = "secs", default = 0, help = "When searching for a keyserver and not all volumes can be unlocked, abort after this period of time, given in seconds. Defaults to infinity. This argument can be specified as a host-based configuration parameter as well; the command-line argument always takes precedence.")
 parser.add_argument("-p", "--port", metavar = "port", default = 23170, help = "Port that is used for both UDP and TCP communication. Defaults to %(default)d.")
+parser.add_argument("--max-broadcast-interval", metavar = "millis", type = int, default = 16000, help = "When no keyserver answers, the interval between discovery broadcasts is doubled after every attempt, randomized to avoid many clients broadcasting in lockstep. This is the ceiling of that interval. Defaults to %(default)d ms.")
+parser.add_argument("-w", "--discovery-window", metavar = "millis", type = int, default = 100, help = "After the first keyserver answered a broadcast, wait this long for answers of further keyservers. They are then tried in order of their response time. Defaults to %(default)d ms.")
+parser.add_argument("--connect-stagger", metavar = "millis", type = int, default = 250, help = "When multiple keyservers are known, start connecting to the next one after this time even if the previous attempts are still pending. Defaults to %(default)d ms.")
+parser.add_argument("--connect-timeout", metavar = "millis", type = int, default = 5000, help = "Give up on a keyserver if connection and TLS handshake did not complete within this time. Defaults to %(default)d ms.")
+parser.add_argument("-j", "--parallel", metavar = "count", type = int, default = 2, help = "Number of LUKS volumes that are unlocked concurrently once the keys have been received. Note that every unlock operation may require a significant amount of memory for Argon2 key derivation. Defaults to %(default)d.")
 parser.add_argument("--no-luks", action = "store_true", help = "Do not call LUKS/cryptsetup. Useful for testing unlocking procedure.")
 parser.add_argument("-v", "--verbose", action = "count", default = 0, help = "Increase verbosity. Can be specified multiple times.")
 parser.add_argument("filename", metavar = "filename", help = "Exported database file to load TLS-PSKs and list of disks from.")
-parser.add_argument("hostname", metavar = "hostname", nargs = "?", help = "When hostname is given, auto-searching for suitable servers is disabled and only a connection to the given hostname is attempted.")
+parser.add_argument("hostname", metavar = "hostname", nargs = "*", help = "When one or more hostnames are given, auto-searching for suitable servers is disabled and only connections to the given keyservers are attempted. All of their addresses are tried concurrently and the first one to respond is used.")
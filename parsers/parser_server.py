@@ -2,5 +2,15 @@ import argparse
 parser = argparse.ArgumentParser(prog = "luksrku server", description = "Starts a luksrku key server.", add_help = False)
 parser.add_argument("-p", "--port", metavar = "port", default = 23170, help = "Port that is used for both UDP and TCP communication. Defaults to %(default)d.")
 parser.add_argument("-s", "--silent", action = "store_true", help = "Do not answer UDP queries for clients trying to find a key server, only serve key database using TCP.")
+parser.add_argument("-e", "--engine", choices = [ "epoll", "pool", "threads" ], default = "epoll", help = "Connection handling engine to use. \"epoll\" drives all TLS handshakes non-blocking from a small number of event loop threads, \"pool\" hands connections to a fixed-size pool of worker threads through a bounded queue and rejects clients when that queue is full, \"threads\" creates one thread per connecting client. Defaults to %(default)s.")
+parser.add_argument("-t", "--threads", metavar = "count", type = int, default = 0, help = "Number of event loop threads (epoll engine) or worker threads (pool engine) to use. Defaults to the number of online CPUs.")
+parser.add_argument("-q", "--queue-depth", metavar = "count", type = int, default = 256, help = "Number of accepted connections that may wait for a worker thread when using the pool engine. Connections exceeding this are closed immediately. With the epoll engine, this is the number of handshakes that may wait for a vault worker thread; beyond that, the event loop opens the vault itself. Defaults to %(default)d.")
+parser.add_argument("-a", "--acceptors", metavar = "count", type = int, default = 1, help = "Number of TCP listening sockets to open. When more than one is used, all are bound to the same port using SO_REUSEPORT and the kernel distributes incoming connections among them; each is served by its own accept loop. A value of 0 opens one listening socket per online CPU. Defaults to %(default)d.")
+parser.add_argument("-b", "--backlog", metavar = "count", type = int, default = 128, help = "Length of the pending connection backlog of each TCP listening socket. Defaults to %(default)d.")
+parser.add_argument("--vault-shards", metavar = "count", type = int, default = 16, help = "Number of separately encrypted in-memory vaults the key database is split into. Hosts in different shards can be served concurrently and opening a shard only decrypts the keys of its hosts, but every shard keeps 2 MiB of pre-key material in memory and costs one key derivation at startup. A value of 0 uses one shard per host. At most 64 shards are created, i.e., 128 MiB. Defaults to %(default)d.")
+parser.add_argument("--kdf-lanes", metavar = "count", type = int, default = 0, help = "Number of parallel lanes the in-memory vault key derivation is split into. The total work factor of the derivation stays the same, but it is spread across multiple CPU cores, reducing unlock latency. At most 16 lanes are used. Defaults to the number of online CPUs.")
+parser.add_argument("--coalesce-window", metavar = "millis", type = int, default = 0, help = "Keep a vault shard decrypted for this many milliseconds after the last client is served, so that clients arriving in close succession are served from the same decryption. This trades a slightly longer exposure of the keys in memory for less key derivation work during boot storms. Defaults to %(default)d, which seals vaults immediately.")
+parser.add_argument("--coalesce-max-batch", metavar = "count", type = int, default = 64, help = "Maximum number of clients that are served from one vault decryption when coalescing is enabled. Defaults to %(default)d.")
+parser.add_argument("--warm-up-ttl", metavar = "millis", type = int, default = 0, help = "When a known host announces itself via UDP discovery, start decrypting its vault shard right away and keep it decrypted for this many milliseconds, so that the subsequent connection does not have to wait for the key derivation. Only has an effect when UDP queries are answered. Since discovery is unauthenticated, this lets anyone who knows a host UUID keep its shard decrypted. Defaults to %(default)d, which disables warm-up.")
 parser.add_argument("-v", "--verbose", action = "count", default = 0, help = "Increase verbosity. Can be specified multiple times.")
 parser.add_argument("filename", metavar = "filename", help = "Database file to load keys from.")
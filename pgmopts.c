@@ -76,6 +76,67 @@ static bool server_callback(enum argparse_server_option_t option, const char *va
 			pgmopts_rw.server.answer_udp_queries = false;
 			break;
 
+		case ARG_SERVER_ENGINE:
+			if (!strcasecmp(value, "epoll")) {
+				pgmopts_rw.server.engine = SERVER_ENGINE_EPOLL;
+			} else if (!strcasecmp(value, "pool")) {
+				pgmopts_rw.server.engine = SERVER_ENGINE_POOL;
+			} else if (!strcasecmp(value, "threads")) {
+				pgmopts_rw.server.engine = SERVER_ENGINE_THREADS;
+			} else {
+				errmsg_callback("invalid engine \"%s\" given, must be one of \"epoll\", \"pool\" or \"threads\"", value);
+				return false;
+			}
+			break;
+
+		case ARG_SERVER_THREADS:
+			pgmopts_rw.server.thread_count = atoi(value);
+			break;
+
+		case ARG_SERVER_QUEUE_DEPTH:
+			pgmopts_rw.server.queue_depth = atoi(value);
+			if (pgmopts_rw.server.queue_depth == 0) {
+				errmsg_callback("queue depth must be at least 1");
+				return false;
+			}
+			break;
+
+		case ARG_SERVER_ACCEPTORS:
+			pgmopts_rw.server.acceptor_count = atoi(value);
+			break;
+
+		case ARG_SERVER_BACKLOG:
+			pgmopts_rw.server.backlog = atoi(value);
+			if (pgmopts_rw.server.backlog == 0) {
+				errmsg_callback("listen backlog must be at least 1");
+				return false;
+			}
+			break;
+
+		case ARG_SERVER_VAULT_SHARDS:
+			pgmopts_rw.server.vault_shards = atoi(value);
+			break;
+
+		case ARG_SERVER_KDF_LANES:
+			pgmopts_rw.server.kdf_lanes = atoi(value);
+			break;
+
+		case ARG_SERVER_COALESCE_WINDOW:
+			pgmopts_rw.server.coalesce_window_millis = atoi(value);
+			break;
+
+		case ARG_SERVER_COALESCE_MAX_BATCH:
+			pgmopts_rw.server.coalesce_max_batch = atoi(value);
+			if (pgmopts_rw.server.coalesce_max_batch == 0) {
+				errmsg_callback("coalescing batch size must be at least 1");
+				return false;
+			}
+			break;
+
+		case ARG_SERVER_WARM_UP_TTL:
+			pgmopts_rw.server.warm_up_ttl_millis = atoi(value);
+			break;
+
 		case ARG_SERVER_VERBOSE:
 			pgmopts_rw.server.verbosity++;
 			break;
@@ -90,7 +151,11 @@ static bool client_callback(enum argparse_client_option_t option, const char *va
 			break;
 
 		case ARG_CLIENT_HOSTNAME:
-			pgmopts_rw.client.hostname = value;
+			if (pgmopts_rw.client.hostname_count == KEYSERVER_MAX_CANDIDATES) {
+				errmsg_callback("at most %d keyservers may be given", KEYSERVER_MAX_CANDIDATES);
+				return false;
+			}
+			pgmopts_rw.client.hostnames[pgmopts_rw.client.hostname_count++] = value;
 			break;
 
 		case ARG_CLIENT_PORT:
@@ -101,6 +166,38 @@ static bool client_callback(enum argparse_client_option_t option, const char *va
 			pgmopts_rw.client.timeout_seconds = atoi(value);
 			break;
 
+		case ARG_CLIENT_MAX_BROADCAST_INTERVAL:
+			pgmopts_rw.client.max_broadcast_interval_millis = atoi(value);
+			if (pgmopts_rw.client.max_broadcast_interval_millis < 100) {
+				errmsg_callback("maximum broadcast interval must be at least 100 ms");
+				return false;
+			}
+			break;
+
+		case ARG_CLIENT_DISCOVERY_WINDOW:
+			pgmopts_rw.client.discovery_window_millis = atoi(value);
+			break;
+
+		case ARG_CLIENT_CONNECT_STAGGER:
+			pgmopts_rw.client.connect_stagger_millis = atoi(value);
+			break;
+
+		case ARG_CLIENT_CONNECT_TIMEOUT:
+			pgmopts_rw.client.connect_timeout_millis = atoi(value);
+			if (pgmopts_rw.client.connect_timeout_millis == 0) {
+				errmsg_callback("connect timeout must be at least 1 ms");
+				return false;
+			}
+			break;
+
+		case ARG_CLIENT_PARALLEL:
+			pgmopts_rw.client.parallel_unlocks = atoi(value);
+			if (pgmopts_rw.client.parallel_unlocks == 0) {
+				errmsg_callback("parallel unlock count must be at least 1");
+				return false;
+			}
+			break;
+
 		case ARG_CLIENT_NO_LUKS:
 			pgmopts_rw.client.no_luks = true;
 			break;
@@ -124,6 +221,16 @@ static void parse_pgmopts_server(int argc, char **argv) {
 		.port = ARGPARSE_SERVER_DEFAULT_PORT,
 		.verbosity = ARGPARSE_SERVER_DEFAULT_VERBOSE,
 		.answer_udp_queries = true,
+		.engine = SERVER_ENGINE_EPOLL,
+		.thread_count = ARGPARSE_SERVER_DEFAULT_THREADS,
+		.queue_depth = ARGPARSE_SERVER_DEFAULT_QUEUE_DEPTH,
+		.acceptor_count = ARGPARSE_SERVER_DEFAULT_ACCEPTORS,
+		.backlog = ARGPARSE_SERVER_DEFAULT_BACKLOG,
+		.vault_shards = ARGPARSE_SERVER_DEFAULT_VAULT_SHARDS,
+		.kdf_lanes = ARGPARSE_SERVER_DEFAULT_KDF_LANES,
+		.coalesce_window_millis = ARGPARSE_SERVER_DEFAULT_COALESCE_WINDOW,
+		.coalesce_max_batch = ARGPARSE_SERVER_DEFAULT_COALESCE_MAX_BATCH,
+		.warm_up_ttl_millis = ARGPARSE_SERVER_DEFAULT_WARM_UP_TTL,
 	};
 	argparse_server_parse_or_quit(argc - 1, argv + 1, server_callback, NULL);
 }
@@ -131,6 +238,11 @@ static void parse_pgmopts_server(int argc, char **argv) {
 static void parse_pgmopts_client(int argc, char **argv) {
 	pgmopts_rw.client = (struct pgmopts_client_t){
 		.timeout_seconds = ARGPARSE_CLIENT_DEFAULT_TIMEOUT,
+		.max_broadcast_interval_millis = ARGPARSE_CLIENT_DEFAULT_MAX_BROADCAST_INTERVAL,
+		.discovery_window_millis = ARGPARSE_CLIENT_DEFAULT_DISCOVERY_WINDOW,
+		.connect_stagger_millis = ARGPARSE_CLIENT_DEFAULT_CONNECT_STAGGER,
+		.connect_timeout_millis = ARGPARSE_CLIENT_DEFAULT_CONNECT_TIMEOUT,
+		.parallel_unlocks = ARGPARSE_CLIENT_DEFAULT_PARALLEL,
 		.port = ARGPARSE_SERVER_DEFAULT_PORT,
 		.verbosity = ARGPARSE_SERVER_DEFAULT_VERBOSE,
 	};
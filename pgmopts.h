@@ -25,6 +25,7 @@
 #define __PGMOPTS_H__
 
 #include <stdbool.h>
+#include "global.h"
 
 enum pgmopts_pgm_t {
 	PGM_EDIT,
@@ -32,6 +33,12 @@ enum pgmopts_pgm_t {
 	PGM_CLIENT,
 };
 
+enum server_engine_t {
+	SERVER_ENGINE_EPOLL,
+	SERVER_ENGINE_POOL,
+	SERVER_ENGINE_THREADS,
+};
+
 struct pgmopts_edit_t {
 	const char *filename;
 	unsigned int verbosity;
@@ -41,14 +48,30 @@ struct pgmopts_server_t {
 	const char *filename;
 	unsigned int port;
 	bool answer_udp_queries;
+	enum server_engine_t engine;
+	unsigned int thread_count;
+	unsigned int queue_depth;
+	unsigned int acceptor_count;
+	unsigned int backlog;
+	unsigned int vault_shards;
+	unsigned int kdf_lanes;
+	unsigned int coalesce_window_millis;
+	unsigned int coalesce_max_batch;
+	unsigned int warm_up_ttl_millis;
 	unsigned int verbosity;
 };
 
 struct pgmopts_client_t {
 	const char *filename;
-	const char *hostname;
+	const char *hostnames[KEYSERVER_MAX_CANDIDATES];
+	unsigned int hostname_count;
 	unsigned int port;
 	unsigned int timeout_seconds;
+	unsigned int max_broadcast_interval_millis;
+	unsigned int discovery_window_millis;
+	unsigned int connect_stagger_millis;
+	unsigned int connect_timeout_millis;
+	unsigned int parallel_unlocks;
 	bool no_luks;
 	unsigned int verbosity;
 };
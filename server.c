@@ -21,6 +21,9 @@
 	Johannes Bauer <JohannesBauer@gmx.de>
 */
 
+/* Required for SO_REUSEPORT */
+#define _DEFAULT_SOURCE
+
 #include <stdio.h>
 #include <string.h>
 #include <sys/socket.h>
@@ -48,35 +51,74 @@
 #include "keydb.h"
 #include "signals.h"
 #include "udp.h"
+#include "ipaddr.h"
 #include "blacklist.h"
 #include "vaulted_keydb.h"
+#include "keydb_index.h"
+#include "epoll_server.h"
+#include "thread_pool.h"
 
 struct keyserver_t {
 	keydb_t* keydb;
+	struct keydb_index_t *keydb_index;
 	struct vaulted_keydb_t *vaulted_keydb;
 	struct generic_tls_ctx_t gctx;
 	const struct pgmopts_server_t *opts;
-	int tcp_sd, udp_sd;
+	int *tcp_sds;
+	unsigned int tcp_sd_count;
+	int udp_sd;
+	struct thread_pool_t *vault_pool;
+	struct blacklist_t *blacklist;
+};
+
+enum credential_fetch_t {
+	CREDENTIAL_FETCH_NONE,
+	CREDENTIAL_FETCH_PENDING,
+	CREDENTIAL_FETCH_DONE,
 };
 
 struct client_thread_ctx_t {
 	struct generic_tls_ctx_t *gctx;
-	const keydb_t *keydb;
+	const struct keydb_index_t *keydb_index;
 	struct vaulted_keydb_t *vaulted_keydb;
 	const host_entry_t *host;
 	int fd;
+	/* With the epoll engine, credentials are fetched by a vault worker while
+	 * the handshake is parked; the blocking engines leave these NULL and
+	 * fetch from within the PSK callback */
+	struct epoll_connection_t *epoll_conn;
+	struct thread_pool_t *vault_pool;
+	enum credential_fetch_t credential_fetch;
+	bool have_credentials;
+	struct host_credentials_vault_entry_t credentials;
+	bool volume_key_delivery;
+	unsigned int msg_count;
+	union {
+		struct msg_t plain[MAX_VOLUMES_PER_HOST];
+		struct msg_volume_key_t with_volume_key[MAX_VOLUMES_PER_HOST];
+	} msgs;
+};
+
+struct acceptor_thread_ctx_t {
+	struct keyserver_t *keyserver;
+	struct thread_pool_t *pool;
+	unsigned int acceptor_id;
+	int tcp_sd;
 };
 
 struct udp_listen_thread_ctx_t {
-	const keydb_t *keydb;
+	const struct keydb_index_t *keydb_index;
+	struct vaulted_keydb_t *vaulted_keydb;
+	struct blacklist_t *blacklist;
+	unsigned int warm_up_ttl_millis;
 	int udp_sd;
 	unsigned int port;
 };
 
-static int create_tcp_server_socket(int port) {
-	int sd = socket(AF_INET, SOCK_STREAM, 0);
+static int create_tcp_server_socket(int port, bool reuse_port, int backlog) {
+	int sd = create_dual_stack_socket(SOCK_STREAM);
 	if (sd < 0) {
-		log_libc(LLVL_ERROR, "Unable to create TCP socket(2)");
+		log_msg(LLVL_ERROR, "Unable to create TCP socket");
 		return -1;
 	}
 
@@ -85,30 +127,37 @@ static int create_tcp_server_socket(int port) {
 		setsockopt(sd, SOL_SOCKET, SO_REUSEADDR, &value, sizeof(value));
 	}
 
-	struct sockaddr_in addr = {
-		.sin_family = AF_INET,
-		.sin_port = htons(port),
-		.sin_addr.s_addr = htonl(INADDR_ANY),
-	};
-	if (bind(sd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
-		log_libc(LLVL_ERROR, "Unable to bind(2) socket");
+	if (reuse_port) {
+		/* Multiple sockets bound to the same port; the kernel distributes
+		 * incoming connections among them */
+		int value = 1;
+		if (setsockopt(sd, SOL_SOCKET, SO_REUSEPORT, &value, sizeof(value)) < 0) {
+			log_libc(LLVL_ERROR, "Unable to set SO_REUSEPORT on socket");
+			close(sd);
+			return -1;
+		}
+	}
+
+	if (!bind_wildcard_address(sd, port)) {
+		close(sd);
 		return -1;
 	}
 
-	if (listen(sd, 1) < 0) {
+	if (listen(sd, backlog) < 0) {
 		log_libc(LLVL_ERROR, "Unable to listen(2) on socket");
+		close(sd);
 		return -1;
 	}
 
 	return sd;
 }
 
-static int psk_server_callback(SSL *ssl, const unsigned char *identity, size_t identity_len, SSL_SESSION **sessptr) {
-	struct client_thread_ctx_t *ctx = (struct client_thread_ctx_t*)SSL_get_app_data(ssl);
-
+/* Looks up the host that a PSK identity, i.e., the ASCII host UUID, belongs
+ * to */
+static const host_entry_t *psk_identity_to_host(const struct keydb_index_t *keydb_index, const unsigned char *identity, size_t identity_len) {
 	if (identity_len != ASCII_UUID_CHARACTER_COUNT) {
 		log_msg(LLVL_WARNING, "Received client identity of length %ld, cannot be a UUID.", identity_len);
-		return 0;
+		return NULL;
 	}
 
 	char uuid_str[ASCII_UUID_BUFSIZE];
@@ -116,35 +165,169 @@ static int psk_server_callback(SSL *ssl, const unsigned char *identity, size_t i
 	uuid_str[ASCII_UUID_CHARACTER_COUNT] = 0;
 	if (!is_valid_uuid(uuid_str)) {
 		log_msg(LLVL_WARNING, "Received client identity of length %ld, but not a valid UUID.", identity_len);
-		return 0;
+		return NULL;
 	}
 
 	uint8_t uuid[16];
 	if (!parse_uuid(uuid, uuid_str)) {
 		log_msg(LLVL_ERROR, "Failed to parse valid UUID.");
-		return 0;
+		return NULL;
 	}
 
-	ctx->host = keydb_get_host_by_uuid(ctx->keydb, uuid);
-	if (!ctx->host) {
+	const host_entry_t *host = keydb_index_get_host_by_uuid(keydb_index, uuid);
+	if (!host) {
 		log_msg(LLVL_WARNING, "Client connected with client UUID %s, but not present in key database.", uuid_str);
-		return 0;
+		return NULL;
 	}
+	return host;
+}
+
+struct vault_fetch_job_t {
+	struct client_thread_ctx_t *client;
+};
+
+static void vault_fetch_job(void *vjob) {
+	struct vault_fetch_job_t *job = (struct vault_fetch_job_t*)vjob;
+	struct client_thread_ctx_t *client = job->client;
+	client->have_credentials = vaulted_keydb_get_host_credentials(client->vaulted_keydb, &client->credentials, client->host);
+	client->credential_fetch = CREDENTIAL_FETCH_DONE;
+	epoll_server_resume(client->epoll_conn);
+}
+
+/* Runs before OpenSSL processes the ClientHello any further, in particular
+ * before the key share is computed. Clients whose PSK identity is unknown
+ * cannot complete the handshake anyways, so they are turned away right here
+ * at almost no cost.
+ * With a vault worker pool, the credentials of known clients are fetched in
+ * the background meanwhile: the handshake is parked by returning
+ * SSL_CLIENT_HELLO_RETRY and OpenSSL calls us again once it is resumed. */
+static int client_hello_callback(SSL *ssl, int *alert, void *arg) {
+	struct client_thread_ctx_t *ctx = (struct client_thread_ctx_t*)SSL_get_app_data(ssl);
+
+	if (ctx->credential_fetch == CREDENTIAL_FETCH_PENDING) {
+		return SSL_CLIENT_HELLO_RETRY;
+	} else if (ctx->credential_fetch == CREDENTIAL_FETCH_DONE) {
+		if (!ctx->have_credentials) {
+			log_msg(LLVL_WARNING, "Cannot establish server connection without TLS-PSK.");
+			*alert = SSL_AD_INTERNAL_ERROR;
+			return SSL_CLIENT_HELLO_ERROR;
+		}
+		return SSL_CLIENT_HELLO_SUCCESS;
+	}
+
+	struct openssl_psk_identity_t identities[4];
+	const unsigned int identity_count = openssl_client_hello_psk_identities(ssl, identities, sizeof(identities) / sizeof(identities[0]));
+	const host_entry_t *host = NULL;
+	for (unsigned int i = 0; (i < identity_count) && !host; i++) {
+		host = psk_identity_to_host(ctx->keydb_index, identities[i].identity, identities[i].length);
+	}
+	if (!host) {
+		if (identity_count == 0) {
+			log_msg(LLVL_WARNING, "Client offered no usable PSK identity, aborting handshake.");
+		}
+		*alert = SSL_AD_UNKNOWN_PSK_IDENTITY;
+		return SSL_CLIENT_HELLO_ERROR;
+	}
+
+	if (ctx->vault_pool) {
+		ctx->host = host;
+		struct vault_fetch_job_t job = {
+			.client = ctx,
+		};
+		if (thread_pool_submit(ctx->vault_pool, &job)) {
+			ctx->credential_fetch = CREDENTIAL_FETCH_PENDING;
+			return SSL_CLIENT_HELLO_RETRY;
+		}
+		/* Queue full, the PSK callback fetches synchronously instead */
+		log_msg(LLVL_DEBUG, "Vault worker queue full, fetching credentials within the handshake.");
+	}
+	return SSL_CLIENT_HELLO_SUCCESS;
+}
 
-	uint8_t psk[PSK_SIZE_BYTES];
-	if (!vaulted_keydb_get_tls_psk(ctx->vaulted_keydb, psk, ctx->host)) {
-		log_msg(LLVL_WARNING, "Cannot establish server connection without TLS-PSK.");
+static int psk_server_callback(SSL *ssl, const unsigned char *identity, size_t identity_len, SSL_SESSION **sessptr) {
+	struct client_thread_ctx_t *ctx = (struct client_thread_ctx_t*)SSL_get_app_data(ssl);
+
+	const host_entry_t *host = psk_identity_to_host(ctx->keydb_index, identity, identity_len);
+	if (!host) {
 		return 0;
 	}
 
-	int result = openssl_tls13_psk_establish_session(ssl, psk, PSK_SIZE_BYTES, EVP_sha256(), sessptr);
-	OPENSSL_cleanse(psk, PSK_SIZE_BYTES);
-	return result;
+	if (!ctx->have_credentials || (host != ctx->host)) {
+		/* Fetch all credentials of the host at once; the LUKS passphrases are
+		 * kept in the connection context until they're sent, which saves
+		 * another vault opening later on. */
+		OPENSSL_cleanse(&ctx->credentials, sizeof(ctx->credentials));
+		ctx->host = host;
+		ctx->have_credentials = vaulted_keydb_get_host_credentials(ctx->vaulted_keydb, &ctx->credentials, ctx->host);
+		if (!ctx->have_credentials) {
+			log_msg(LLVL_WARNING, "Cannot establish server connection without TLS-PSK.");
+			return 0;
+		}
+	}
+
+	/* The PSK must survive until the handshake is complete, since this
+	 * callback runs again for the second ClientHello after a
+	 * HelloRetryRequest. All credentials are wiped once the handshake
+	 * completes or the connection is torn down. */
+	return openssl_tls13_psk_establish_session(ssl, ctx->credentials.tls_psk, PSK_SIZE_BYTES, EVP_sha256(), sessptr);
 }
 
-static void copy_luks_passphrase_callback(void *vctx, unsigned int volume_index, const void *source) {
-	struct msg_t *msgs = (struct msg_t*)vctx;
-	memcpy(msgs[volume_index].luks_passphrase_raw, source, LUKS_PASSPHRASE_RAW_SIZE_BYTES);
+static int alpn_select_callback(SSL *ssl, const unsigned char **out, unsigned char *outlen, const unsigned char *in, unsigned int inlen, void *arg) {
+	const unsigned int protocol_length = strlen(MSG_ALPN_VOLUME_KEY);
+	unsigned int offset = 0;
+	while (offset < inlen) {
+		const unsigned int length = in[offset];
+		if (offset + 1 + length > inlen) {
+			break;
+		}
+		if ((length == protocol_length) && !memcmp(in + offset + 1, MSG_ALPN_VOLUME_KEY, length)) {
+			*out = in + offset + 1;
+			*outlen = length;
+			return SSL_TLSEXT_ERR_OK;
+		}
+		offset += 1 + length;
+	}
+	return SSL_TLSEXT_ERR_NOACK;
+}
+
+static unsigned int client_unlock_messages_size(const struct client_thread_ctx_t *client) {
+	const unsigned int msg_size = client->volume_key_delivery ? sizeof(struct msg_volume_key_t) : sizeof(struct msg_t);
+	return msg_size * client->msg_count;
+}
+
+/* Fills the messages for all volumes of the host that the client
+ * authenticated as. Works for all server engines. */
+static bool client_prepare_unlock_messages(struct client_thread_ctx_t *client, SSL *ssl) {
+	if (!client->host || !client->have_credentials) {
+		log_msg(LLVL_FATAL, "Client connected, but no host set.");
+		return false;
+	}
+
+	client->volume_key_delivery = openssl_alpn_negotiated(ssl, MSG_ALPN_VOLUME_KEY);
+	log_msg(LLVL_DEBUG, "Client \"%s\" connected, sending unlock data for %d volumes%s.", client->host->host_name, client->host->volume_count, client->volume_key_delivery ? " (volume keys supported)" : "");
+	/* Prepare all messages we're about to send to the client from the
+	 * credentials that were fetched during the handshake, then wipe those */
+	for (unsigned int i = 0; i < client->host->volume_count; i++) {
+		const volume_entry_t *volume = &client->host->volumes[i];
+		struct msg_t *msg = client->volume_key_delivery ? &client->msgs.with_volume_key[i].msg : &client->msgs.plain[i];
+		memcpy(msg->volume_uuid, volume->volume_uuid, 16);
+		memcpy(msg->luks_passphrase_raw, client->credentials.volumes[i].luks_passphrase_raw, LUKS_PASSPHRASE_RAW_SIZE_BYTES);
+
+		if (client->volume_key_delivery) {
+			struct msg_volume_key_t *vk_msg = &client->msgs.with_volume_key[i];
+			if (volume->volume_flags & VOLUME_FLAG_DELIVER_VOLUME_KEY) {
+				vk_msg->luks_volume_key_length = client->credentials.volumes[i].luks_volume_key_length;
+				memcpy(vk_msg->luks_volume_key, client->credentials.volumes[i].luks_volume_key, LUKS_VOLUME_KEY_MAX_SIZE_BYTES);
+			} else {
+				vk_msg->luks_volume_key_length = 0;
+				memset(vk_msg->luks_volume_key, 0, LUKS_VOLUME_KEY_MAX_SIZE_BYTES);
+			}
+		}
+	}
+	OPENSSL_cleanse(&client->credentials, sizeof(client->credentials));
+	client->have_credentials = false;
+	client->msg_count = client->host->volume_count;
+	return true;
 }
 
 static void client_handler_thread(void *vctx) {
@@ -158,71 +341,292 @@ static void client_handler_thread(void *vctx) {
 		if (SSL_accept(ssl) <= 0) {
 			log_openssl(LLVL_WARNING, "Could not establish TLS connection to connecting client.");
 			ERR_print_errors_fp(stderr);
-		} else {
-			if (client->host) {
-				log_msg(LLVL_DEBUG, "Client \"%s\" connected, sending unlock data for %d volumes.", client->host->host_name, client->host->volume_count);
-				/* Initially prepare all messages we're about to send to the
-				 * client by filling the UUID fields */
-				struct msg_t msgs[client->host->volume_count];
-				for (unsigned int i = 0; i < client->host->volume_count; i++) {
-					const volume_entry_t *volume = &client->host->volumes[i];
-					memcpy(msgs[i].volume_uuid, volume->volume_uuid, 16);
-				}
-
-				/* Then also fill the keys */
-				vaulted_keydb_get_volume_luks_passphases_raw(client->vaulted_keydb, copy_luks_passphrase_callback, msgs, client->host);
-
-				int txlen = SSL_write(ssl, &msgs, sizeof(msgs));
-				OPENSSL_cleanse(&msgs, sizeof(msgs));
-				if (txlen != (long)sizeof(msgs)) {
-					log_msg(LLVL_WARNING, "Tried to send message of %ld bytes, but sent %d. Severing connection to client.", sizeof(msgs), txlen);
-				}
-			} else {
-				log_msg(LLVL_FATAL, "Client connected, but no host set.");
+		} else if (client_prepare_unlock_messages(client, ssl)) {
+			const unsigned int msgs_size = client_unlock_messages_size(client);
+			int txlen = SSL_write(ssl, &client->msgs, msgs_size);
+			if (txlen != (long)msgs_size) {
+				log_msg(LLVL_WARNING, "Tried to send message of %u bytes, but sent %d. Severing connection to client.", msgs_size, txlen);
 			}
 		}
 	} else {
 		log_openssl(LLVL_FATAL, "Cannot establish SSL context for connecting client");
 	}
+	OPENSSL_cleanse(&client->credentials, sizeof(client->credentials));
+	OPENSSL_cleanse(&client->msgs, sizeof(client->msgs));
 	SSL_free(ssl);
 	shutdown(client->fd, SHUT_RDWR);
 	close(client->fd);
 }
 
+static void* epoll_client_open(void *vctx, int fd, struct epoll_connection_t *conn) {
+	struct keyserver_t *keyserver = (struct keyserver_t*)vctx;
+	struct client_thread_ctx_t *client = calloc(1, sizeof(struct client_thread_ctx_t));
+	if (!client) {
+		log_libc(LLVL_ERROR, "Unable to calloc(3) client context");
+		return NULL;
+	}
+	client->gctx = &keyserver->gctx;
+	client->keydb_index = keyserver->keydb_index;
+	client->vaulted_keydb = keyserver->vaulted_keydb;
+	client->fd = fd;
+	client->epoll_conn = conn;
+	client->vault_pool = keyserver->vault_pool;
+	return client;
+}
+
+static bool epoll_client_established(void *vctx, SSL *ssl, const void **txdata, unsigned int *txlength) {
+	struct client_thread_ctx_t *client = (struct client_thread_ctx_t*)vctx;
+	if (!client_prepare_unlock_messages(client, ssl)) {
+		return false;
+	}
+	*txdata = &client->msgs;
+	*txlength = client_unlock_messages_size(client);
+	return true;
+}
+
+static void epoll_client_close(void *vctx) {
+	struct client_thread_ctx_t *client = (struct client_thread_ctx_t*)vctx;
+	OPENSSL_cleanse(client, sizeof(struct client_thread_ctx_t));
+	free(client);
+}
+
 static void udp_handler_thread(void *vctx) {
 	struct udp_listen_thread_ctx_t *client = (struct udp_listen_thread_ctx_t*)vctx;
 
+	struct udp_response_t tx_msg;
+	memcpy(tx_msg.magic, UDP_MESSAGE_MAGIC, UDP_MESSAGE_MAGIC_SIZE);
+
+	struct udp_query_batch_t batch;
+	struct sockaddr_storage destinations[UDP_BATCH_SIZE];
+	uint64_t queries_received = 0;
+	uint64_t datagrams_rejected = 0;
+	uint64_t logged_datagrams = 0;
+	uint32_t logged_drops = 0;
+	double next_stats_time = now() + KEYSERVER_UDP_STATS_INTERVAL_SECS;
 	while (true) {
-		struct udp_query_t rx_msg;
-		struct sockaddr_in origin;
-		if (!wait_udp_query(client->udp_sd, &rx_msg, &origin)) {
+		if (now() >= next_stats_time) {
+			/* Most junk never reaches us thanks to the socket filter, so
+			 * the kernel's drop count is the interesting one */
+			const uint32_t kernel_drops = udp_socket_drop_count(client->udp_sd);
+			if ((queries_received + datagrams_rejected != logged_datagrams) || (kernel_drops != logged_drops)) {
+				log_msg(LLVL_DEBUG, "Discovery: %lu queries received, %lu datagrams rejected, %u dropped by kernel (filtered or queue full).", (unsigned long)queries_received, (unsigned long)datagrams_rejected, kernel_drops);
+				logged_datagrams = queries_received + datagrams_rejected;
+				logged_drops = kernel_drops;
+			}
+			next_stats_time = now() + KEYSERVER_UDP_STATS_INTERVAL_SECS;
+		}
+
+		if (!wait_udp_query_batch(client->udp_sd, &batch)) {
 			continue;
 		}
+		queries_received += batch.query_count;
+		datagrams_rejected += batch.received_count - batch.query_count;
+
+		unsigned int destination_count = 0;
+		for (unsigned int i = 0; i < batch.query_count; i++) {
+			const struct sockaddr_storage *origin = &batch.sources[i];
+			if (should_log(LLVL_TRACE)) {
+				char origin_str[IP_ADDRESS_BUFSIZE];
+				sprintf_sockaddr(origin_str, origin);
+				log_msg(LLVL_TRACE, "Recevied UDP query message from %s port %u", origin_str, sockaddr_get_port(origin));
+			}
+
+			/* Ensure that we only reply to this host once per blacklisting
+			 * timeout */
+			struct ip_address_t origin_ip;
+			ip_address_from_sockaddr(&origin_ip, origin);
+			if (!blacklist_ip_unless_listed(client->blacklist, &origin_ip, BLACKLIST_TIMEOUT_SERVER)) {
+				continue;
+			}
+
+			/* Check if we have this host in our database */
+			const host_entry_t *host = keydb_index_get_host_by_uuid(client->keydb_index, batch.queries[i].host_uuid);
+			if (host) {
+				/* Yes, it is. Notify the client who's asking that we have their key. */
+				destinations[destination_count++] = *origin;
+
+				/* The client will connect shortly, so have its credentials
+				 * ready by then */
+				if (client->warm_up_ttl_millis) {
+					log_msg(LLVL_TRACE, "Warming up vault for host %s.", host->host_name);
+					vaulted_keydb_warm_up(client->vaulted_keydb, host, client->warm_up_ttl_millis);
+				}
+			}
+		}
 
-		log_msg(LLVL_TRACE, "Recevied UDP query message from %d.%d.%d.%d:%d", PRINTF_FORMAT_IP(&origin), ntohs(origin.sin_port));
+		log_msg(LLVL_TRACE, "Processed UDP batch of %u datagrams, %u valid queries, answering %u.", batch.received_count, batch.query_count, destination_count);
+		if (destination_count) {
+			send_udp_message_batch(client->udp_sd, destinations, destination_count, &tx_msg, sizeof(tx_msg), true);
+		}
+	}
+}
+
+static void threads_acceptor_thread(void *vctx) {
+	struct acceptor_thread_ctx_t *acceptor = (struct acceptor_thread_ctx_t*)vctx;
+	struct keyserver_t *keyserver = acceptor->keyserver;
+	while (true) {
+		struct sockaddr_storage addr;
+		socklen_t len = sizeof(addr);
+		int client = accept(acceptor->tcp_sd, (struct sockaddr*)&addr, &len);
+		if (client < 0) {
+			log_libc(LLVL_ERROR, "Unable to accept(2)");
+			return;
+		}
+
+		/* Client has connected, fire up client thread. */
+		struct client_thread_ctx_t client_ctx = {
+			.gctx = &keyserver->gctx,
+			.keydb_index = keyserver->keydb_index,
+			.vaulted_keydb = keyserver->vaulted_keydb,
+			.fd = client,
+		};
+		if (!pthread_create_detached_thread(client_handler_thread, &client_ctx, sizeof(client_ctx))) {
+			log_libc(LLVL_FATAL, "Unable to create detached thread for client.");
+			close(client);
+			return;
+		}
+	}
+}
+
+/* Runs one accept loop per listening socket. All but the first run in
+ * detached threads, the first one runs in the calling thread. Only returns
+ * when that first accept loop terminates. */
+static bool keyserver_run_acceptors(struct keyserver_t *keyserver, struct thread_pool_t *pool, void (*acceptor_function)(void *ctx)) {
+	for (unsigned int i = 1; i < keyserver->tcp_sd_count; i++) {
+		struct acceptor_thread_ctx_t acceptor_ctx = {
+			.keyserver = keyserver,
+			.pool = pool,
+			.acceptor_id = i,
+			.tcp_sd = keyserver->tcp_sds[i],
+		};
+		if (!pthread_create_detached_thread(acceptor_function, &acceptor_ctx, sizeof(acceptor_ctx))) {
+			log_libc(LLVL_FATAL, "Unable to create detached thread for acceptor %u.", i);
+			return false;
+		}
+	}
+	log_msg(LLVL_DEBUG, "Accepting clients from %u listening sockets.", keyserver->tcp_sd_count);
+
+	struct acceptor_thread_ctx_t acceptor_ctx = {
+		.keyserver = keyserver,
+		.pool = pool,
+		.acceptor_id = 0,
+		.tcp_sd = keyserver->tcp_sds[0],
+	};
+	acceptor_function(&acceptor_ctx);
+	return false;
+}
+
+static bool keyserver_serve_threads(struct keyserver_t *keyserver) {
+	return keyserver_run_acceptors(keyserver, NULL, threads_acceptor_thread);
+}
+
+static void keyserver_log_pool_stats(struct thread_pool_t *pool) {
+	struct thread_pool_stats_t stats;
+	thread_pool_get_stats(pool, &stats);
+	const double avg_wait_time = stats.jobs_completed ? (stats.total_wait_time / stats.jobs_completed) : 0;
+	log_msg(LLVL_DEBUG, "Worker pool: %u of %u queued (max %u), %lu served, %lu rejected, wait time avg %.1f ms max %.1f ms.", stats.queue_depth, stats.queue_capacity, stats.max_queue_depth, (unsigned long)stats.jobs_completed, (unsigned long)stats.jobs_rejected, avg_wait_time * 1000, stats.max_wait_time * 1000);
+}
+
+static bool set_socket_timeouts(int sd, unsigned int timeout_millis) {
+	struct timeval tv = {
+		.tv_sec = timeout_millis / 1000,
+		.tv_usec = (timeout_millis % 1000) * 1000,
+	};
+	if (setsockopt(sd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) || setsockopt(sd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv))) {
+		log_libc(LLVL_ERROR, "Unable to set client socket timeout to %u ms.", timeout_millis);
+		return false;
+	}
+	return true;
+}
+
+static void pool_acceptor_thread(void *vctx) {
+	struct acceptor_thread_ctx_t *acceptor = (struct acceptor_thread_ctx_t*)vctx;
+	struct keyserver_t *keyserver = acceptor->keyserver;
+
+	double next_stats_time = now() + KEYSERVER_POOL_STATS_INTERVAL_SECS;
+	while (true) {
+		int client = accept(acceptor->tcp_sd, NULL, NULL);
+		if (client < 0) {
+			log_libc(LLVL_ERROR, "Unable to accept(2)");
+			break;
+		}
 
-		/* Ensure that we only reply to this host once every minute */
-		const uint32_t ipv4 = origin.sin_addr.s_addr;
-		if (is_ip_blacklisted(ipv4)) {
+		/* Workers block in SSL_accept(3) and SSL_write(3), which must not
+		 * be stalled forever by a client that stops talking */
+		if (!set_socket_timeouts(client, KEYSERVER_POOL_SOCKET_TIMEOUT_MILLIS)) {
+			close(client);
 			continue;
 		}
-		blacklist_ip(ipv4, BLACKLIST_TIMEOUT_SERVER);
 
-		/* Check if we have this host in our database */
-		if (keydb_get_host_by_uuid(client->keydb, rx_msg.host_uuid)) {
-			/* Yes, it is. Notify the client who's asking that we have their key. */
-			struct udp_response_t tx_msg;
-			memcpy(tx_msg.magic, UDP_MESSAGE_MAGIC, UDP_MESSAGE_MAGIC_SIZE);
-			send_udp_message(client->udp_sd, &origin, &tx_msg, sizeof(tx_msg), true);
+		struct client_thread_ctx_t client_ctx = {
+			.gctx = &keyserver->gctx,
+			.keydb_index = keyserver->keydb_index,
+			.vaulted_keydb = keyserver->vaulted_keydb,
+			.fd = client,
+		};
+		if (!thread_pool_submit(acceptor->pool, &client_ctx)) {
+			/* Shed load early instead of letting the client wait for a
+			 * handshake that would time out anyways */
+			log_msg(LLVL_WARNING, "Worker pool queue full, rejecting client connection.");
+			close(client);
+		}
+
+		/* Statistics are shared by all acceptors, only the first reports them */
+		if ((acceptor->acceptor_id == 0) && (now() >= next_stats_time)) {
+			keyserver_log_pool_stats(acceptor->pool);
+			next_stats_time = now() + KEYSERVER_POOL_STATS_INTERVAL_SECS;
 		}
 	}
 }
 
+static bool keyserver_serve_pool(struct keyserver_t *keyserver) {
+	struct thread_pool_t *pool = thread_pool_new(keyserver->opts->thread_count, keyserver->opts->queue_depth, sizeof(struct client_thread_ctx_t), client_handler_thread);
+	if (!pool) {
+		log_msg(LLVL_FATAL, "Unable to create worker pool.");
+		return false;
+	}
+
+	bool success = keyserver_run_acceptors(keyserver, pool, pool_acceptor_thread);
+	keyserver_log_pool_stats(pool);
+	if (keyserver->tcp_sd_count == 1) {
+		/* With multiple acceptors, detached threads might still be submitting
+		 * jobs; we leave the pool for process termination to clean up */
+		thread_pool_free(pool);
+	}
+	return success;
+}
+
+static bool keyserver_serve_epoll(struct keyserver_t *keyserver) {
+	/* Vault openings block on the key derivation, so they are moved off the
+	 * event loops */
+	keyserver->vault_pool = thread_pool_new(0, keyserver->opts->queue_depth, sizeof(struct vault_fetch_job_t), vault_fetch_job);
+	if (!keyserver->vault_pool) {
+		log_msg(LLVL_FATAL, "Unable to create vault worker pool.");
+		return false;
+	}
+
+	struct epoll_server_config_t config = {
+		.ssl_ctx = keyserver->gctx.ctx,
+		.listen_sds = keyserver->tcp_sds,
+		.listen_sd_count = keyserver->tcp_sd_count,
+		.thread_count = keyserver->opts->thread_count,
+		.server_ctx = keyserver,
+		.callbacks = {
+			.connection_open = epoll_client_open,
+			.connection_established = epoll_client_established,
+			.connection_close = epoll_client_close,
+		},
+	};
+	/* Event loops only terminate on fatal errors while vault workers might
+	 * still refer to parked handshakes; we leave the pool for process
+	 * termination to clean up */
+	return epoll_server_run(&config);
+}
+
 bool keyserver_start(const struct pgmopts_server_t *opts) {
 	bool success = true;
 	struct keyserver_t keyserver = {
 		.opts = opts,
-		.tcp_sd = -1,
 		.udp_sd = -1,
 	};
 	do {
@@ -249,13 +653,22 @@ bool keyserver_start(const struct pgmopts_server_t *opts) {
 			break;
 		}
 
+		/* Index host UUIDs for fast lookup during discovery and handshake */
+		keyserver.keydb_index = keydb_index_new(keyserver.keydb);
+		if (!keyserver.keydb_index) {
+			log_msg(LLVL_FATAL, "Failed to build key database index.");
+			success = false;
+			break;
+		}
+
 		/* Then convert it into a vaulted key database */
-		keyserver.vaulted_keydb = vaulted_keydb_new(keyserver.keydb);
+		keyserver.vaulted_keydb = vaulted_keydb_new(keyserver.keydb, opts->vault_shards, opts->kdf_lanes);
 		if (!keyserver.vaulted_keydb) {
 			log_msg(LLVL_FATAL, "Failed to create vaulted key database.");
 			success = false;
 			break;
 		}
+		vaulted_keydb_set_coalescing(keyserver.vaulted_keydb, opts->coalesce_window_millis, opts->coalesce_max_batch);
 
 		if (!create_generic_tls_context(&keyserver.gctx, true)) {
 			log_msg(LLVL_FATAL, "Failed to create OpenSSL server context.");
@@ -263,24 +676,53 @@ bool keyserver_start(const struct pgmopts_server_t *opts) {
 			break;
 		}
 
+		SSL_CTX_set_client_hello_cb(keyserver.gctx.ctx, client_hello_callback, NULL);
 		SSL_CTX_set_psk_find_session_callback(keyserver.gctx.ctx, psk_server_callback);
+		SSL_CTX_set_alpn_select_cb(keyserver.gctx.ctx, alpn_select_callback, NULL);
 
-		keyserver.tcp_sd = create_tcp_server_socket(opts->port);
-		if (keyserver.tcp_sd == -1) {
+		unsigned int acceptor_count = opts->acceptor_count;
+		if (acceptor_count == 0) {
+			long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+			acceptor_count = (cpu_count > 0) ? cpu_count : 1;
+		}
+		keyserver.tcp_sds = calloc(acceptor_count, sizeof(int));
+		if (!keyserver.tcp_sds) {
+			log_libc(LLVL_FATAL, "Unable to calloc(3) server sockets");
+			success = false;
+			break;
+		}
+		for (unsigned int i = 0; i < acceptor_count; i++) {
+			int sd = create_tcp_server_socket(opts->port, acceptor_count > 1, opts->backlog);
+			if (sd == -1) {
+				break;
+			}
+			keyserver.tcp_sds[keyserver.tcp_sd_count++] = sd;
+		}
+		if (keyserver.tcp_sd_count != acceptor_count) {
 			log_msg(LLVL_ERROR, "Cannot start server without server socket.");
 			success = false;
 			break;
 		}
 
 		if (opts->answer_udp_queries) {
-			keyserver.udp_sd = create_udp_socket(opts->port, false, 1000);
+			keyserver.udp_sd = create_udp_socket(opts->port, false, 1000, sizeof(struct udp_query_t));
 			if (keyserver.udp_sd == -1) {
 				success = false;
 				break;
 			}
+			keyserver.blacklist = blacklist_new(BLACKLIST_ENTRIES_PER_HOST * keyserver.keydb->host_count);
+			if (!keyserver.blacklist) {
+				success = false;
+				break;
+			}
+			unsigned int multicast_interface_count = join_udp_multicast_group(keyserver.udp_sd);
+			log_msg(LLVL_DEBUG, "Answering IPv6 discovery queries on %u interface(s).", multicast_interface_count);
 
 			struct udp_listen_thread_ctx_t udp_thread_ctx = {
-				.keydb = keyserver.keydb,
+				.keydb_index = keyserver.keydb_index,
+				.vaulted_keydb = keyserver.vaulted_keydb,
+				.blacklist = keyserver.blacklist,
+				.warm_up_ttl_millis = opts->warm_up_ttl_millis,
 				.udp_sd = keyserver.udp_sd,
 				.port = keyserver.opts->port,
 			};
@@ -292,38 +734,31 @@ bool keyserver_start(const struct pgmopts_server_t *opts) {
 		}
 
 		log_msg(LLVL_INFO, "Serving luksrku database for %u hosts.", keyserver.keydb->host_count);
-		while (true) {
-			struct sockaddr_in addr;
-			unsigned int len = sizeof(addr);
-			int client = accept(keyserver.tcp_sd, (struct sockaddr*)&addr, &len);
-			if (client < 0) {
-				log_libc(LLVL_ERROR, "Unable to accept(2)");
-				success = false;
+		switch (opts->engine) {
+			case SERVER_ENGINE_EPOLL:
+				success = keyserver_serve_epoll(&keyserver);
 				break;
-			}
 
-			/* Client has connected, fire up client thread. */
-			struct client_thread_ctx_t client_ctx = {
-				.gctx = &keyserver.gctx,
-				.keydb = keyserver.keydb,
-				.vaulted_keydb = keyserver.vaulted_keydb,
-				.fd = client,
-			};
-			if (!pthread_create_detached_thread(client_handler_thread, &client_ctx, sizeof(client_ctx))) {
-				log_libc(LLVL_FATAL, "Unable to create detached thread for client.");
-				success = false;
+			case SERVER_ENGINE_POOL:
+				success = keyserver_serve_pool(&keyserver);
+				break;
+
+			case SERVER_ENGINE_THREADS:
+				success = keyserver_serve_threads(&keyserver);
 				break;
-			}
 		}
 	} while (false);
 	if (keyserver.udp_sd != -1) {
 		close(keyserver.udp_sd);
 	}
-	if (keyserver.tcp_sd != -1) {
-		close(keyserver.tcp_sd);
+	for (unsigned int i = 0; i < keyserver.tcp_sd_count; i++) {
+		close(keyserver.tcp_sds[i]);
 	}
+	free(keyserver.tcp_sds);
 	free_generic_tls_context(&keyserver.gctx);
+	blacklist_free(keyserver.blacklist);
 	vaulted_keydb_free(keyserver.vaulted_keydb);
+	keydb_index_free(keyserver.keydb_index);
 	keydb_free(keyserver.keydb);
 	return success;
 }
@@ -0,0 +1,242 @@
+/*
+	luksrku - Tool to remotely unlock LUKS disks using TLS.
+	Copyright (C) 2016-2026 Johannes Bauer
+
+	This file is part of luksrku.
+
+	luksrku is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; this program is ONLY licensed under
+	version 3 of the License, later versions are explicitly excluded.
+
+	luksrku is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with luksrku; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+	Johannes Bauer <JohannesBauer@gmx.de>
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sched.h>
+#include <openssl/crypto.h>
+
+#include "thread_pool.h"
+#include "log.h"
+#include "util.h"
+
+/* The queue is the bounded MPMC ring buffer by Dmitry Vyukov: every slot
+ * carries a sequence number that tells producers and consumers whether it is
+ * free to be written or ready to be read, so neither side ever takes a lock. */
+static bool thread_pool_enqueue(struct thread_pool_t *pool, const void *job) {
+	size_t pos = atomic_load_explicit(&pool->enqueue_pos, memory_order_relaxed);
+	struct thread_pool_slot_t *slot;
+	while (true) {
+		slot = &pool->slots[pos & pool->queue_mask];
+		size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+		intptr_t difference = (intptr_t)sequence - (intptr_t)pos;
+		if (difference == 0) {
+			if (atomic_compare_exchange_weak_explicit(&pool->enqueue_pos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+				break;
+			}
+		} else if (difference < 0) {
+			/* Queue full */
+			return false;
+		} else {
+			pos = atomic_load_explicit(&pool->enqueue_pos, memory_order_relaxed);
+		}
+	}
+	memcpy(slot->job, job, pool->job_size);
+	slot->enqueue_time = now();
+	atomic_store_explicit(&slot->sequence, pos + 1, memory_order_release);
+	return true;
+}
+
+static bool thread_pool_dequeue(struct thread_pool_t *pool, void *job, double *enqueue_time) {
+	size_t pos = atomic_load_explicit(&pool->dequeue_pos, memory_order_relaxed);
+	struct thread_pool_slot_t *slot;
+	while (true) {
+		slot = &pool->slots[pos & pool->queue_mask];
+		size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+		intptr_t difference = (intptr_t)sequence - (intptr_t)(pos + 1);
+		if (difference == 0) {
+			if (atomic_compare_exchange_weak_explicit(&pool->dequeue_pos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+				break;
+			}
+		} else if (difference < 0) {
+			/* Queue empty */
+			return false;
+		} else {
+			pos = atomic_load_explicit(&pool->dequeue_pos, memory_order_relaxed);
+		}
+	}
+	memcpy(job, slot->job, pool->job_size);
+	OPENSSL_cleanse(slot->job, pool->job_size);
+	*enqueue_time = slot->enqueue_time;
+	atomic_store_explicit(&slot->sequence, pos + pool->queue_mask + 1, memory_order_release);
+	return true;
+}
+
+static unsigned int thread_pool_queue_depth(struct thread_pool_t *pool) {
+	size_t enqueue_pos = atomic_load_explicit(&pool->enqueue_pos, memory_order_relaxed);
+	size_t dequeue_pos = atomic_load_explicit(&pool->dequeue_pos, memory_order_relaxed);
+	return (enqueue_pos > dequeue_pos) ? (enqueue_pos - dequeue_pos) : 0;
+}
+
+static void* thread_pool_worker(void *vctx) {
+	struct thread_pool_t *pool = (struct thread_pool_t*)vctx;
+	uint8_t job[pool->job_size];
+
+	while (true) {
+		if (sem_wait(&pool->jobs_available)) {
+			if (errno == EINTR) {
+				continue;
+			}
+			log_libc(LLVL_FATAL, "Worker pool thread failed in sem_wait(3)");
+			break;
+		}
+		if (atomic_load(&pool->shutdown)) {
+			break;
+		}
+
+		/* The semaphore guarantees that a job has been claimed for us, but
+		 * with multiple producers the slot at the head of the queue may not
+		 * be published yet. It will be momentarily. */
+		double enqueue_time;
+		while (!thread_pool_dequeue(pool, job, &enqueue_time)) {
+			sched_yield();
+		}
+		const double wait_time = now() - enqueue_time;
+		log_msg(LLVL_TRACE, "Worker picked up job after %.1f ms, %u jobs still queued.", wait_time * 1000, thread_pool_queue_depth(pool));
+
+		pool->job_function(job);
+		OPENSSL_cleanse(job, pool->job_size);
+
+		pthread_mutex_lock(&pool->stats_mutex);
+		pool->stats.jobs_completed++;
+		pool->stats.total_wait_time += wait_time;
+		if (wait_time > pool->stats.max_wait_time) {
+			pool->stats.max_wait_time = wait_time;
+		}
+		pthread_mutex_unlock(&pool->stats_mutex);
+	}
+	return NULL;
+}
+
+struct thread_pool_t *thread_pool_new(unsigned int worker_count, unsigned int queue_capacity, unsigned int job_size, void (*job_function)(void *job)) {
+	if (worker_count == 0) {
+		long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+		worker_count = (cpu_count > 0) ? cpu_count : 1;
+	}
+
+	/* Round capacity up to the next power of two */
+	size_t capacity = 2;
+	while (capacity < queue_capacity) {
+		capacity *= 2;
+	}
+
+	struct thread_pool_t *pool = calloc(1, sizeof(struct thread_pool_t));
+	if (!pool) {
+		log_libc(LLVL_FATAL, "Unable to calloc(3) worker pool");
+		return NULL;
+	}
+	pool->job_function = job_function;
+	pool->job_size = job_size;
+	pool->worker_count = worker_count;
+	pool->queue_mask = capacity - 1;
+	pool->stats.queue_capacity = capacity;
+	if (pthread_mutex_init(&pool->stats_mutex, NULL)) {
+		log_libc(LLVL_FATAL, "Unable to initialize worker pool mutex.");
+		free(pool);
+		return NULL;
+	}
+	if (sem_init(&pool->jobs_available, 0, 0)) {
+		log_libc(LLVL_FATAL, "Unable to initialize worker pool semaphore.");
+		pthread_mutex_destroy(&pool->stats_mutex);
+		free(pool);
+		return NULL;
+	}
+
+	pool->slots = calloc(capacity, sizeof(struct thread_pool_slot_t));
+	pool->job_data = calloc(capacity, job_size);
+	pool->workers = calloc(worker_count, sizeof(pthread_t));
+	if (!pool->slots || !pool->job_data || !pool->workers) {
+		log_libc(LLVL_FATAL, "Unable to calloc(3) worker pool queue of %zu entries", capacity);
+		thread_pool_free(pool);
+		return NULL;
+	}
+	for (size_t i = 0; i < capacity; i++) {
+		atomic_init(&pool->slots[i].sequence, i);
+		pool->slots[i].job = pool->job_data + (i * job_size);
+	}
+
+	for (unsigned int i = 0; i < worker_count; i++) {
+		if (pthread_create(&pool->workers[i], NULL, thread_pool_worker, pool)) {
+			log_libc(LLVL_FATAL, "Unable to pthread_create(3) worker thread %u", i);
+			thread_pool_free(pool);
+			return NULL;
+		}
+		pool->workers_running++;
+	}
+	log_msg(LLVL_DEBUG, "Started worker pool with %u threads and a queue of %zu entries.", worker_count, capacity);
+	return pool;
+}
+
+bool thread_pool_submit(struct thread_pool_t *pool, const void *job) {
+	if (!thread_pool_enqueue(pool, job)) {
+		atomic_fetch_add_explicit(&pool->jobs_rejected, 1, memory_order_relaxed);
+		return false;
+	}
+
+	unsigned int depth = thread_pool_queue_depth(pool);
+	unsigned int max_depth = atomic_load_explicit(&pool->max_queue_depth, memory_order_relaxed);
+	while (depth > max_depth) {
+		if (atomic_compare_exchange_weak_explicit(&pool->max_queue_depth, &max_depth, depth, memory_order_relaxed, memory_order_relaxed)) {
+			break;
+		}
+	}
+
+	sem_post(&pool->jobs_available);
+	return true;
+}
+
+void thread_pool_get_stats(struct thread_pool_t *pool, struct thread_pool_stats_t *stats) {
+	pthread_mutex_lock(&pool->stats_mutex);
+	*stats = pool->stats;
+	pthread_mutex_unlock(&pool->stats_mutex);
+	stats->queue_depth = thread_pool_queue_depth(pool);
+	stats->max_queue_depth = atomic_load(&pool->max_queue_depth);
+	stats->jobs_rejected = atomic_load(&pool->jobs_rejected);
+}
+
+void thread_pool_free(struct thread_pool_t *pool) {
+	if (!pool) {
+		return;
+	}
+	atomic_store(&pool->shutdown, true);
+	for (unsigned int i = 0; i < pool->workers_running; i++) {
+		sem_post(&pool->jobs_available);
+	}
+	for (unsigned int i = 0; i < pool->workers_running; i++) {
+		pthread_join(pool->workers[i], NULL);
+	}
+	if (pool->job_data) {
+		OPENSSL_cleanse(pool->job_data, (pool->queue_mask + 1) * pool->job_size);
+	}
+	sem_destroy(&pool->jobs_available);
+	pthread_mutex_destroy(&pool->stats_mutex);
+	free(pool->workers);
+	free(pool->job_data);
+	free(pool->slots);
+	free(pool);
+}
@@ -0,0 +1,81 @@
+/*
+	luksrku - Tool to remotely unlock LUKS disks using TLS.
+	Copyright (C) 2016-2026 Johannes Bauer
+
+	This file is part of luksrku.
+
+	luksrku is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; this program is ONLY licensed under
+	version 3 of the License, later versions are explicitly excluded.
+
+	luksrku is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with luksrku; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+	Johannes Bauer <JohannesBauer@gmx.de>
+*/
+
+#ifndef __THREAD_POOL_H__
+#define __THREAD_POOL_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+struct thread_pool_slot_t {
+	atomic_size_t sequence;
+	double enqueue_time;
+	void *job;
+};
+
+struct thread_pool_stats_t {
+	unsigned int queue_capacity;
+	unsigned int queue_depth;
+	unsigned int max_queue_depth;
+	uint64_t jobs_completed;
+	uint64_t jobs_rejected;
+	double total_wait_time;
+	double max_wait_time;
+};
+
+struct thread_pool_t {
+	void (*job_function)(void *job);
+	unsigned int job_size;
+	unsigned int worker_count;
+	pthread_t *workers;
+	unsigned int workers_running;
+	atomic_bool shutdown;
+	sem_t jobs_available;
+
+	/* Bounded lock-free MPMC queue; capacity is a power of two */
+	struct thread_pool_slot_t *slots;
+	uint8_t *job_data;
+	size_t queue_mask;
+	atomic_size_t enqueue_pos;
+	atomic_size_t dequeue_pos;
+
+	/* Admission statistics are atomic so submission never takes a lock,
+	 * worker statistics are guarded by the mutex */
+	atomic_uint max_queue_depth;
+	atomic_uint_fast64_t jobs_rejected;
+	pthread_mutex_t stats_mutex;
+	struct thread_pool_stats_t stats;
+};
+
+/*************** AUTO GENERATED SECTION FOLLOWS ***************/
+struct thread_pool_t *thread_pool_new(unsigned int worker_count, unsigned int queue_capacity, unsigned int job_size, void (*job_function)(void *job));
+bool thread_pool_submit(struct thread_pool_t *pool, const void *job);
+void thread_pool_get_stats(struct thread_pool_t *pool, struct thread_pool_stats_t *stats);
+void thread_pool_free(struct thread_pool_t *pool);
+/***************  AUTO GENERATED SECTION ENDS   ***************/
+
+#endif
@@ -21,6 +21,9 @@
 	Johannes Bauer <JohannesBauer@gmx.de>
 */
 
+/* Required for recvmmsg(2) and sendmmsg(2) */
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdbool.h>
 #include <sys/types.h>
@@ -29,16 +32,74 @@
 #include <string.h>
 #include <sys/time.h>
 #include <arpa/inet.h>
+#include <poll.h>
+#include <errno.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <linux/filter.h>
+#include <linux/sock_diag.h>
 
 #include "log.h"
 #include "udp.h"
+#include "ipaddr.h"
+
+static int udp_socket_family(int sd) {
+	struct sockaddr_storage address;
+	socklen_t address_length = sizeof(address);
+	if (getsockname(sd, (struct sockaddr*)&address, &address_length)) {
+		return AF_INET;
+	}
+	return address.ss_family;
+}
 
-int create_udp_socket(unsigned int listen_port, bool send_broadcast, unsigned int rx_timeout_millis) {
-	int sd = socket(AF_INET, SOCK_DGRAM, 0);
+/* Attaches a classic BPF program that only lets datagrams of exactly
+ * message_length bytes pass which start with the message magic. Everything
+ * else is dropped by the kernel before it is queued on the socket. The
+ * program sees the UDP header first, the payload starts at offset 8. */
+static bool attach_udp_message_filter(int sd, unsigned int message_length) {
+	const unsigned int payload_offset = 8;
+	struct sock_filter filter[] = {
+		BPF_STMT(BPF_LD | BPF_W | BPF_LEN, 0),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, payload_offset + message_length, 0, 9),
+		/* Four words of magic, filled in below */
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 0), BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, 0, 7),
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 0), BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, 0, 5),
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 0), BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, 0, 3),
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 0), BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, 0, 1),
+		BPF_STMT(BPF_RET | BPF_K, 0xffffffff),
+		BPF_STMT(BPF_RET | BPF_K, 0),
+	};
+	_Static_assert(UDP_MESSAGE_MAGIC_SIZE == 16, "BPF filter assumes four words of magic");
+	const uint8_t *magic = UDP_MESSAGE_MAGIC;
+	for (unsigned int i = 0; i < UDP_MESSAGE_MAGIC_SIZE / 4; i++) {
+		/* Absolute loads are in network byte order */
+		filter[2 + (2 * i)].k = payload_offset + (4 * i);
+		filter[3 + (2 * i)].k = ((uint32_t)magic[4 * i] << 24) | ((uint32_t)magic[(4 * i) + 1] << 16) | ((uint32_t)magic[(4 * i) + 2] << 8) | magic[(4 * i) + 3];
+	}
+
+	struct sock_fprog program = {
+		.len = sizeof(filter) / sizeof(filter[0]),
+		.filter = filter,
+	};
+	if (setsockopt(sd, SOL_SOCKET, SO_ATTACH_FILTER, &program, sizeof(program))) {
+		log_libc(LLVL_WARNING, "Unable to attach UDP socket filter using setsockopt(2), filtering in userspace only");
+		return false;
+	}
+	return true;
+}
+
+/* A non-zero filter_message_length only accepts messages of that size which
+ * carry the message magic, see attach_udp_message_filter(). */
+int create_udp_socket(unsigned int listen_port, bool send_broadcast, unsigned int rx_timeout_millis, unsigned int filter_message_length) {
+	int sd = create_dual_stack_socket(SOCK_DGRAM);
 	if (sd < 0) {
-		log_libc(LLVL_ERROR, "Unable to create UDP server socket(2)");
+		log_msg(LLVL_ERROR, "Unable to create UDP socket");
 		return -1;
 	}
+	if (filter_message_length) {
+		/* Attach before binding so that nothing is queued unfiltered */
+		attach_udp_message_filter(sd, filter_message_length);
+	}
 	if (send_broadcast) {
 		int value = 1;
 		if (setsockopt(sd, SOL_SOCKET, SO_BROADCAST, &value, sizeof(value))) {
@@ -49,13 +110,8 @@ int create_udp_socket(unsigned int listen_port, bool send_broadcast, unsigned in
 	}
 
 	if (listen_port) {
-		struct sockaddr_in addr = {
-			.sin_family = AF_INET,
-			.sin_port = htons(listen_port),
-			.sin_addr.s_addr = htonl(INADDR_ANY),
-		};
-		if (bind(sd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
-			log_libc(LLVL_ERROR, "Unable to bind UDP socket to listen to port %d", listen_port);
+		if (!bind_wildcard_address(sd, listen_port)) {
+			log_msg(LLVL_ERROR, "Unable to bind UDP socket to listen to port %d", listen_port);
 			close(sd);
 			return -1;
 		}
@@ -74,15 +130,74 @@ int create_udp_socket(unsigned int listen_port, bool send_broadcast, unsigned in
 
 	return sd;
 }
-bool wait_udp_message(int sd, void *data, unsigned int length, struct sockaddr_in *source) {
-	socklen_t socklen = sizeof(struct sockaddr_in);
+
+/* IPv6 has no broadcast; servers instead join the link-local discovery
+ * multicast group on every interface that supports multicast. Interfaces
+ * which come up later are not covered. Returns the number of interfaces
+ * joined. */
+unsigned int join_udp_multicast_group(int sd) {
+	if (udp_socket_family(sd) != AF_INET6) {
+		return 0;
+	}
+
+	struct ifaddrs *ifaddrs;
+	if (getifaddrs(&ifaddrs)) {
+		log_libc(LLVL_ERROR, "Unable to enumerate network interfaces using getifaddrs(3)");
+		return 0;
+	}
+
+	struct ipv6_mreq membership = { 0 };
+	inet_pton(AF_INET6, UDP_MULTICAST_GROUP, &membership.ipv6mr_multiaddr);
+	unsigned int joined_indices[UDP_MAX_BROADCAST_TARGETS];
+	unsigned int joined_count = 0;
+	for (struct ifaddrs *ifa = ifaddrs; ifa && (joined_count < UDP_MAX_BROADCAST_TARGETS); ifa = ifa->ifa_next) {
+		if (!ifa->ifa_addr || (ifa->ifa_addr->sa_family != AF_INET6)) {
+			continue;
+		}
+		if (!(ifa->ifa_flags & IFF_UP) || !(ifa->ifa_flags & IFF_MULTICAST)) {
+			continue;
+		}
+		const unsigned int index = if_nametoindex(ifa->ifa_name);
+		bool already_joined = false;
+		for (unsigned int i = 0; i < joined_count; i++) {
+			if (joined_indices[i] == index) {
+				already_joined = true;
+				break;
+			}
+		}
+		if (!index || already_joined) {
+			continue;
+		}
+
+		membership.ipv6mr_interface = index;
+		if (setsockopt(sd, IPPROTO_IPV6, IPV6_JOIN_GROUP, &membership, sizeof(membership))) {
+			log_libc(LLVL_WARNING, "Unable to join discovery multicast group on interface %s", ifa->ifa_name);
+			continue;
+		}
+		log_msg(LLVL_TRACE, "Joined discovery multicast group on interface %s", ifa->ifa_name);
+		joined_indices[joined_count++] = index;
+	}
+	freeifaddrs(ifaddrs);
+	return joined_count;
+}
+
+/* Source addresses are always reported as plain IPv4 or IPv6 addresses, even
+ * on dual-stack sockets */
+bool wait_udp_message(int sd, void *data, unsigned int length, struct sockaddr_storage *source) {
+	socklen_t socklen = sizeof(struct sockaddr_storage);
 	ssize_t rx_bytes = recvfrom(sd,data, length, 0, (struct sockaddr*)source, &socklen);
+	sockaddr_unmap_ipv4(source);
 	return rx_bytes == length;
 }
 
-bool send_udp_message(int sd, struct sockaddr_in *destination, const void *data, unsigned int length, bool is_response) {
+bool send_udp_message(int sd, const struct sockaddr_storage *destination, const void *data, unsigned int length, bool is_response) {
+	struct sockaddr_storage tx_destination = *destination;
+	if (udp_socket_family(sd) == AF_INET6) {
+		sockaddr_map_ipv4(&tx_destination);
+	}
+
 	int flags = is_response ? MSG_CONFIRM : 0;
-	ssize_t tx_bytes = sendto(sd, data, length, flags, (struct sockaddr*)destination, sizeof(struct sockaddr_in));
+	ssize_t tx_bytes = sendto(sd, data, length, flags, (struct sockaddr*)&tx_destination, sockaddr_length(&tx_destination));
 	if (tx_bytes < 0) {
 		log_libc(LLVL_ERROR, "Unable to sendto(2)");
 		return false;
@@ -94,15 +209,101 @@ bool send_udp_message(int sd, struct sockaddr_in *destination, const void *data,
 }
 
 bool send_udp_broadcast_message(int sd, int port, const void *data, unsigned int length) {
-	struct sockaddr_in destination = {
-		.sin_family = AF_INET,
-		.sin_port = htons(port),
-		.sin_addr.s_addr = htonl(INADDR_BROADCAST),
-	};
+	struct sockaddr_storage destination = { 0 };
+	struct sockaddr_in *sin = (struct sockaddr_in*)&destination;
+	sin->sin_family = AF_INET;
+	sin->sin_port = htons(port);
+	sin->sin_addr.s_addr = htonl(INADDR_BROADCAST);
 	return send_udp_message(sd, &destination, data, length, false);
 }
 
-bool wait_udp_query(int sd, struct udp_query_t *query, struct sockaddr_in *source) {
+/* Determines the destinations of a discovery broadcast: the directed
+ * broadcast address of every IPv4 interface that is up, so that multi-homed
+ * hosts reach all attached networks and not only the one the kernel picks for
+ * INADDR_BROADCAST, and the link-local discovery multicast group on every
+ * IPv6 interface. */
+unsigned int enumerate_udp_broadcast_targets(struct udp_broadcast_target_t *targets, unsigned int max_targets) {
+	struct ifaddrs *ifaddrs;
+	if (getifaddrs(&ifaddrs)) {
+		log_libc(LLVL_ERROR, "Unable to enumerate network interfaces using getifaddrs(3)");
+		return 0;
+	}
+
+	unsigned int target_count = 0;
+	for (struct ifaddrs *ifa = ifaddrs; ifa && (target_count < max_targets); ifa = ifa->ifa_next) {
+		if (!ifa->ifa_addr || !(ifa->ifa_flags & IFF_UP) || (ifa->ifa_flags & IFF_LOOPBACK)) {
+			continue;
+		}
+
+		struct udp_broadcast_target_t target = { 0 };
+		strncpy(target.interface, ifa->ifa_name, sizeof(target.interface) - 1);
+		target.interface_index = if_nametoindex(ifa->ifa_name);
+		if (ifa->ifa_addr->sa_family == AF_INET) {
+			if (!(ifa->ifa_flags & IFF_BROADCAST) || !ifa->ifa_broadaddr || !ifa->ifa_netmask) {
+				continue;
+			}
+			struct sockaddr_in *sin = (struct sockaddr_in*)&target.destination;
+			sin->sin_family = AF_INET;
+			sin->sin_addr = ((struct sockaddr_in*)ifa->ifa_broadaddr)->sin_addr;
+			target.address = ((struct sockaddr_in*)ifa->ifa_addr)->sin_addr.s_addr;
+			target.netmask = ((struct sockaddr_in*)ifa->ifa_netmask)->sin_addr.s_addr;
+		} else if (ifa->ifa_addr->sa_family == AF_INET6) {
+			if (!(ifa->ifa_flags & IFF_MULTICAST) || !target.interface_index) {
+				continue;
+			}
+			/* Interfaces usually carry multiple IPv6 addresses, but the
+			 * group only needs to be addressed once */
+			bool duplicate = false;
+			for (unsigned int i = 0; i < target_count; i++) {
+				if ((targets[i].destination.ss_family == AF_INET6) && (targets[i].interface_index == target.interface_index)) {
+					duplicate = true;
+					break;
+				}
+			}
+			if (duplicate) {
+				continue;
+			}
+			struct sockaddr_in6 *sin6 = (struct sockaddr_in6*)&target.destination;
+			sin6->sin6_family = AF_INET6;
+			sin6->sin6_scope_id = target.interface_index;
+			inet_pton(AF_INET6, UDP_MULTICAST_GROUP, &sin6->sin6_addr);
+		} else {
+			continue;
+		}
+		targets[target_count++] = target;
+	}
+	freeifaddrs(ifaddrs);
+	return target_count;
+}
+
+/* Sends the message to every given broadcast target. A failure on one
+ * interface does not prevent sending on the others; IPv6 targets are skipped
+ * on IPv4-only sockets. Without any interfaces, falls back to
+ * INADDR_BROADCAST. Returns true if the message left through at least one
+ * interface. */
+bool send_udp_broadcast_message_all(int sd, int port, const struct udp_broadcast_target_t *targets, unsigned int target_count, const void *data, unsigned int length) {
+	if (target_count == 0) {
+		return send_udp_broadcast_message(sd, port, data, length);
+	}
+
+	const int socket_family = udp_socket_family(sd);
+	bool success = false;
+	for (unsigned int i = 0; i < target_count; i++) {
+		if ((targets[i].destination.ss_family == AF_INET6) && (socket_family != AF_INET6)) {
+			continue;
+		}
+		struct sockaddr_storage destination = targets[i].destination;
+		sockaddr_set_port(&destination, port);
+		if (send_udp_message(sd, &destination, data, length, false)) {
+			success = true;
+		} else {
+			log_msg(LLVL_WARNING, "%s on interface %s failed.", (destination.ss_family == AF_INET6) ? "Multicast" : "Broadcast", targets[i].interface);
+		}
+	}
+	return success;
+}
+
+bool wait_udp_query(int sd, struct udp_query_t *query, struct sockaddr_storage *source) {
 	bool rx_successful = wait_udp_message(sd, query, sizeof(struct udp_query_t), source);
 	if (rx_successful) {
 		/* Also check if the message contains the correct magic */
@@ -113,7 +314,7 @@ bool wait_udp_query(int sd, struct udp_query_t *query, struct sockaddr_in *sourc
 	return false;
 }
 
-bool wait_udp_response(int sd, struct udp_response_t *response, struct sockaddr_in *source) {
+bool wait_udp_response(int sd, struct udp_response_t *response, struct sockaddr_storage *source) {
 	bool rx_successful = wait_udp_message(sd, response, sizeof(struct udp_response_t), source);
 	if (rx_successful) {
 		/* Also check if the message contains the correct magic */
@@ -123,3 +324,127 @@ bool wait_udp_response(int sd, struct udp_response_t *response, struct sockaddr_
 	}
 	return false;
 }
+
+/* Like wait_udp_response(), but waits at most the given time instead of the
+ * socket's receive timeout */
+bool wait_udp_response_timeout(int sd, struct udp_response_t *response, struct sockaddr_storage *source, unsigned int timeout_millis) {
+	struct pollfd pfd = {
+		.fd = sd,
+		.events = POLLIN,
+	};
+	int result = poll(&pfd, 1, timeout_millis);
+	if (result < 0) {
+		if (errno != EINTR) {
+			log_libc(LLVL_ERROR, "poll(2) on UDP socket failed");
+		}
+		return false;
+	} else if (result == 0) {
+		return false;
+	}
+	return wait_udp_response(sd, response, source);
+}
+
+/* Receives as many queries as are pending (but at least one) with a single
+ * recvmmsg(2) call. Only well-formed queries are put into the batch, in the
+ * order they were received. */
+bool wait_udp_query_batch(int sd, struct udp_query_batch_t *batch) {
+	struct mmsghdr msgs[UDP_BATCH_SIZE];
+	struct iovec iovs[UDP_BATCH_SIZE];
+	struct udp_query_t rx_queries[UDP_BATCH_SIZE];
+	struct sockaddr_storage rx_sources[UDP_BATCH_SIZE];
+
+	memset(msgs, 0, sizeof(msgs));
+	for (unsigned int i = 0; i < UDP_BATCH_SIZE; i++) {
+		iovs[i].iov_base = &rx_queries[i];
+		iovs[i].iov_len = sizeof(struct udp_query_t);
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_name = &rx_sources[i];
+		msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+	}
+
+	batch->received_count = 0;
+	batch->query_count = 0;
+	int rx_count = recvmmsg(sd, msgs, UDP_BATCH_SIZE, MSG_WAITFORONE, NULL);
+	if (rx_count <= 0) {
+		return false;
+	}
+
+	batch->received_count = rx_count;
+	for (int i = 0; i < rx_count; i++) {
+		if (msgs[i].msg_len != sizeof(struct udp_query_t)) {
+			continue;
+		}
+		if (memcmp(rx_queries[i].magic, UDP_MESSAGE_MAGIC, UDP_MESSAGE_MAGIC_SIZE)) {
+			continue;
+		}
+		batch->queries[batch->query_count] = rx_queries[i];
+		sockaddr_unmap_ipv4(&rx_sources[i]);
+		batch->sources[batch->query_count] = rx_sources[i];
+		batch->query_count++;
+	}
+	return true;
+}
+
+/* Returns the number of datagrams the kernel dropped on this socket, either
+ * because the socket filter rejected them or because the receive queue was
+ * full. The kernel does not tell these apart. Returns zero if the count is
+ * unavailable. */
+uint32_t udp_socket_drop_count(int sd) {
+	uint32_t meminfo[SK_MEMINFO_VARS];
+	socklen_t length = sizeof(meminfo);
+	if (getsockopt(sd, SOL_SOCKET, SO_MEMINFO, meminfo, &length) || (length <= SK_MEMINFO_DROPS * sizeof(uint32_t))) {
+		return 0;
+	}
+	return meminfo[SK_MEMINFO_DROPS];
+}
+
+/* Sends the same message to a number of destinations, using as few
+ * sendmmsg(2) calls as possible. */
+bool send_udp_message_batch(int sd, struct sockaddr_storage *destinations, unsigned int destination_count, void *data, unsigned int length, bool is_response) {
+	if (udp_socket_family(sd) == AF_INET6) {
+		for (unsigned int i = 0; i < destination_count; i++) {
+			sockaddr_map_ipv4(&destinations[i]);
+		}
+	}
+
+	struct mmsghdr msgs[UDP_BATCH_SIZE];
+	struct iovec iov = {
+		.iov_base = data,
+		.iov_len = length,
+	};
+	int flags = is_response ? MSG_CONFIRM : 0;
+
+	bool success = true;
+	while (destination_count > 0) {
+		unsigned int chunk_count = (destination_count < UDP_BATCH_SIZE) ? destination_count : UDP_BATCH_SIZE;
+		memset(msgs, 0, sizeof(struct mmsghdr) * chunk_count);
+		for (unsigned int i = 0; i < chunk_count; i++) {
+			msgs[i].msg_hdr.msg_iov = &iov;
+			msgs[i].msg_hdr.msg_iovlen = 1;
+			msgs[i].msg_hdr.msg_name = &destinations[i];
+			msgs[i].msg_hdr.msg_namelen = sockaddr_length(&destinations[i]);
+		}
+
+		int tx_count = sendmmsg(sd, msgs, chunk_count, flags);
+		if ((tx_count < 0) && (errno == EINTR)) {
+			continue;
+		} else if (tx_count <= 0) {
+			/* sendmmsg(2) stops at the first message that cannot be sent,
+			 * e.g., because its destination is unreachable. Skip only that
+			 * one so that the remaining destinations are still served. */
+			char destination_str[IP_ADDRESS_BUFSIZE];
+			sprintf_sockaddr(destination_str, &destinations[0]);
+			if (tx_count < 0) {
+				log_libc(LLVL_ERROR, "Unable to sendmmsg(2) to %s", destination_str);
+			} else {
+				log_msg(LLVL_ERROR, "Unable to sendmmsg(2) to %s, no messages sent.", destination_str);
+			}
+			success = false;
+			tx_count = 1;
+		}
+		destinations += tx_count;
+		destination_count -= tx_count;
+	}
+	return success;
+}
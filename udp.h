@@ -25,15 +25,55 @@
 #define __UDP_H__
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <net/if.h>
 #include "msg.h"
 
+/* Maximum number of datagrams received or sent by one recvmmsg(2) or
+ * sendmmsg(2) call */
+#define UDP_BATCH_SIZE										64
+
+struct udp_query_batch_t {
+	unsigned int received_count;
+	unsigned int query_count;
+	struct udp_query_t queries[UDP_BATCH_SIZE];
+	struct sockaddr_storage sources[UDP_BATCH_SIZE];
+};
+
+/* Link-local IPv6 multicast group that replaces broadcasts for discovery */
+#define UDP_MULTICAST_GROUP									"ff02::6c75:6b73"
+
+/* Maximum number of interfaces a discovery broadcast is sent on */
+#define UDP_MAX_BROADCAST_TARGETS							16
+
+/* An interface that discovery queries are sent on */
+struct udp_broadcast_target_t {
+	char interface[IF_NAMESIZE];
+	unsigned int interface_index;
+	/* Directed IPv4 broadcast or IPv6 multicast address, without port */
+	struct sockaddr_storage destination;
+	/* IPv4 address and netmask in network byte order, used to attribute
+	 * answers to the interface */
+	uint32_t address;
+	uint32_t netmask;
+};
+
 /*************** AUTO GENERATED SECTION FOLLOWS ***************/
-int create_udp_socket(unsigned int listen_port, bool send_broadcast, unsigned int rx_timeout_millis);
-bool wait_udp_message(int sd, void *data, unsigned int length, struct sockaddr_in *source);
-bool send_udp_message(int sd, struct sockaddr_in *destination, const void *data, unsigned int length, bool is_response);
+int create_udp_socket(unsigned int listen_port, bool send_broadcast, unsigned int rx_timeout_millis, unsigned int filter_message_length);
+unsigned int join_udp_multicast_group(int sd);
+bool wait_udp_message(int sd, void *data, unsigned int length, struct sockaddr_storage *source);
+bool send_udp_message(int sd, const struct sockaddr_storage *destination, const void *data, unsigned int length, bool is_response);
 bool send_udp_broadcast_message(int sd, int port, const void *data, unsigned int length);
-bool wait_udp_query(int sd, struct udp_query_t *query, struct sockaddr_in *source);
-bool wait_udp_response(int sd, struct udp_response_t *response, struct sockaddr_in *source);
+unsigned int enumerate_udp_broadcast_targets(struct udp_broadcast_target_t *targets, unsigned int max_targets);
+bool send_udp_broadcast_message_all(int sd, int port, const struct udp_broadcast_target_t *targets, unsigned int target_count, const void *data, unsigned int length);
+bool wait_udp_query(int sd, struct udp_query_t *query, struct sockaddr_storage *source);
+bool wait_udp_response(int sd, struct udp_response_t *response, struct sockaddr_storage *source);
+bool wait_udp_response_timeout(int sd, struct udp_response_t *response, struct sockaddr_storage *source, unsigned int timeout_millis);
+bool wait_udp_query_batch(int sd, struct udp_query_batch_t *batch);
+uint32_t udp_socket_drop_count(int sd);
+bool send_udp_message_batch(int sd, struct sockaddr_storage *destinations, unsigned int destination_count, void *data, unsigned int length, bool is_response);
 /***************  AUTO GENERATED SECTION ENDS   ***************/
 
 #endif
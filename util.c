@@ -25,6 +25,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/time.h>
+#include <time.h>
 #include <openssl/evp.h>
 
 #include "util.h"
@@ -220,3 +221,13 @@ double now(void) {
 	}
 	return tv.tv_sec + (tv.tv_usec * 1e-6);
 }
+
+/* Unlike now(), not affected by changes of the system time. Only suitable for
+ * measuring intervals. */
+double monotonic_now(void) {
+	struct timespec ts;
+	if (clock_gettime(CLOCK_MONOTONIC, &ts)) {
+		return 0;
+	}
+	return ts.tv_sec + (ts.tv_nsec * 1e-9);
+}
@@ -28,8 +28,6 @@
 #include <stdint.h>
 #include <stdbool.h>
 
-#define PRINTF_FORMAT_IP(saddrptr)		((saddrptr)->sin_addr.s_addr >> 0) & 0xff, ((saddrptr)->sin_addr.s_addr >> 8) & 0xff, ((saddrptr)->sin_addr.s_addr >> 16) & 0xff, ((saddrptr)->sin_addr.s_addr >> 24) & 0xff
-
 /*************** AUTO GENERATED SECTION FOLLOWS ***************/
 bool query_passphrase(const char *prompt, char *passphrase, unsigned int passphrase_maxsize);
 void dump_hex_long(FILE *f, const void *vdata, unsigned int length);
@@ -44,6 +42,7 @@ bool is_zero(const void *data, unsigned int length);
 bool array_remove(void *base, unsigned int element_size, unsigned int element_count, unsigned int remove_element_index);
 bool ascii_encode(char *dest, unsigned int dest_buffer_size, const uint8_t *source_data, unsigned int source_data_length);
 double now(void);
+double monotonic_now(void);
 /***************  AUTO GENERATED SECTION ENDS   ***************/
 
 #endif
@@ -24,6 +24,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include <sys/time.h>
 #include <openssl/crypto.h>
 #include <openssl/rand.h>
@@ -32,13 +34,107 @@
 #include "vault.h"
 #include "util.h"
 #include "log.h"
+#include "thread.h"
+
+/* All vaults share one background thread that prepares the key material for
+ * the next re-keying after a vault has been closed, that decrypts vaults ahead
+ * of an announced opening and that seals vaults whose closing was deferred. */
+static pthread_mutex_t background_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t background_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t background_done_cond = PTHREAD_COND_INITIALIZER;
+static struct vault_t *rekey_queue_head;
+static struct vault_t *seal_queue_head;
+static struct vault_t *warm_up_queue_head;
+static bool background_thread_running;
+
+struct vault_kdf_lane_t {
+	const uint8_t *source_key;
+	unsigned int source_key_length;
+	unsigned int lane_index;
+	unsigned int iteration_cnt;
+	pthread_t thread;
+	bool thread_running;
+	bool success;
+	double cpu_time;
+	uint8_t result[32];
+};
+
+/* CPU time consumed by the calling thread. Unlike wall-clock time, this does
+ * not include time spent waiting for a core when there are more lanes than
+ * idle CPUs, which would make calibration pick too few iterations. */
+static double vault_thread_cpu_time(void) {
+	struct timespec ts;
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts)) {
+		return 0;
+	}
+	return ts.tv_sec + (ts.tv_nsec * 1e-9);
+}
 
-static bool vault_derive_key(const struct vault_t *vault, uint8_t dkey[static 32]) {
-	/* Derive the AES key from it */
-	if (PKCS5_PBKDF2_HMAC((char*)vault->source_key, vault->source_key_length, NULL, 0, vault->iteration_cnt, EVP_sha256(), 32, dkey) != 1) {
-		return false;
+static void* vault_kdf_lane_thread(void *vctx) {
+	struct vault_kdf_lane_t *lane = (struct vault_kdf_lane_t*)vctx;
+	/* Lane index is used as the salt so that two identical chunks in
+	 * different lanes do not yield identical results */
+	uint8_t salt[4] = { (lane->lane_index >> 24) & 0xff, (lane->lane_index >> 16) & 0xff, (lane->lane_index >> 8) & 0xff, (lane->lane_index >> 0) & 0xff };
+	double t0 = vault_thread_cpu_time();
+	lane->success = (PKCS5_PBKDF2_HMAC((const char*)lane->source_key, lane->source_key_length, salt, sizeof(salt), lane->iteration_cnt, EVP_sha256(), 32, lane->result) == 1);
+	lane->cpu_time = vault_thread_cpu_time() - t0;
+	return NULL;
+}
+
+/* With multiple KDF lanes, the source key is split into that many chunks.
+ * Each chunk is run through PBKDF2 on its own core and the dkey is the SHA256
+ * over all lane results, so every byte of the source key is still required to
+ * derive it. Optionally returns the sum of CPU time spent in all lanes. */
+static bool vault_derive_key(const struct vault_t *vault, const uint8_t *source_key, uint8_t dkey[static 32], double *cpu_time) {
+	if (vault->kdf_lanes <= 1) {
+		double t0 = vault_thread_cpu_time();
+		bool success = (PKCS5_PBKDF2_HMAC((const char*)source_key, vault->source_key_length, NULL, 0, vault->iteration_cnt, EVP_sha256(), 32, dkey) == 1);
+		if (cpu_time) {
+			*cpu_time = vault_thread_cpu_time() - t0;
+		}
+		return success;
 	}
-	return true;
+
+	struct vault_kdf_lane_t lanes[vault->kdf_lanes];
+	const unsigned int lane_length = vault->source_key_length / vault->kdf_lanes;
+	memset(lanes, 0, sizeof(lanes));
+	for (unsigned int i = 0; i < vault->kdf_lanes; i++) {
+		lanes[i].source_key = source_key + (i * lane_length);
+		lanes[i].source_key_length = (i == vault->kdf_lanes - 1) ? (vault->source_key_length - (i * lane_length)) : lane_length;
+		lanes[i].lane_index = i;
+		lanes[i].iteration_cnt = vault->iteration_cnt;
+	}
+
+	/* First lane is computed by the calling thread; if a thread cannot be
+	 * started, its lane is also computed here */
+	for (unsigned int i = 1; i < vault->kdf_lanes; i++) {
+		lanes[i].thread_running = (pthread_create(&lanes[i].thread, NULL, vault_kdf_lane_thread, &lanes[i]) == 0);
+	}
+	for (unsigned int i = 0; i < vault->kdf_lanes; i++) {
+		if (i == 0 || !lanes[i].thread_running) {
+			vault_kdf_lane_thread(&lanes[i]);
+		}
+	}
+
+	bool success = true;
+	double total_cpu_time = 0;
+	EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+	success = (ctx != NULL) && (EVP_DigestInit_ex(ctx, EVP_sha256(), NULL) == 1);
+	for (unsigned int i = 0; i < vault->kdf_lanes; i++) {
+		if (lanes[i].thread_running) {
+			pthread_join(lanes[i].thread, NULL);
+		}
+		success = success && lanes[i].success;
+		success = success && (EVP_DigestUpdate(ctx, lanes[i].result, sizeof(lanes[i].result)) == 1);
+		total_cpu_time += lanes[i].cpu_time;
+	}
+	success = success && (EVP_DigestFinal_ex(ctx, dkey, NULL) == 1);
+	EVP_MD_CTX_free(ctx);
+	OPENSSL_cleanse(lanes, sizeof(lanes));
+	if (cpu_time) {
+		*cpu_time = total_cpu_time;
+	}
+	return success;
 }
 
 static bool vault_rekey(struct vault_t *vault) {
@@ -46,18 +142,282 @@ static bool vault_rekey(struct vault_t *vault) {
 	if (RAND_bytes(vault->source_key, vault->source_key_length) != 1) {
 		return false;
 	}
-	return vault_derive_key(vault, vault->dkey);
+	return vault_derive_key(vault, vault->source_key, vault->dkey, NULL);
+}
+
+static void vault_prepare_next_key(struct vault_t *vault) {
+	pthread_mutex_lock(&vault->mutex);
+	bool already_prepared = vault->next_key_ready;
+	pthread_mutex_unlock(&vault->mutex);
+	if (already_prepared) {
+		return;
+	}
+
+	/* The next source key is only ever touched by this thread while it is not
+	 * marked ready, so we can fill it without holding the vault mutex; this
+	 * means concurrent vault openers are not blocked by the derivation. */
+	uint8_t dkey[32];
+	bool success = (RAND_bytes(vault->next_source_key, vault->source_key_length) == 1);
+	if (success) {
+		success = vault_derive_key(vault, vault->next_source_key, dkey, NULL);
+	}
+
+	pthread_mutex_lock(&vault->mutex);
+	if (success) {
+		memcpy(vault->next_dkey, dkey, sizeof(dkey));
+		vault->next_key_ready = true;
+	} else {
+		log_openssl(LLVL_ERROR, "Failed to prepare vault re-key in background.");
+	}
+	pthread_mutex_unlock(&vault->mutex);
+	OPENSSL_cleanse(dkey, sizeof(dkey));
+}
+
+static bool vault_encrypt(struct vault_t *vault);
+static bool vault_decrypt(struct vault_t *vault);
+static void vault_schedule_rekey(struct vault_t *vault);
+static bool vault_schedule_seal(struct vault_t *vault, double deadline);
+
+static void vault_log_coalesced_batch(const struct vault_t *vault) {
+	log_msg(LLVL_TRACE, "Sealed vault after serving %u requests from one decryption (%.2f requests per decryption overall).", vault->batch_size, (double)vault->stats.open_count / vault->stats.decrypt_count);
+}
+
+/* Seals a vault whose closing was deferred, unless it was reopened in the
+ * meantime. Unless forced, this only happens once the deadline has passed. */
+static void vault_seal_pending(struct vault_t *vault, bool force) {
+	pthread_mutex_lock(&vault->mutex);
+	bool sealed = false;
+	bool reschedule = false;
+	if (vault->seal_pending && (vault->reference_count == 0)) {
+		if (force || (now() >= vault->seal_deadline)) {
+			vault->seal_pending = false;
+			sealed = vault_encrypt(vault);
+			vault_log_coalesced_batch(vault);
+		} else {
+			/* Vault was reopened and closed again, deadline has moved */
+			reschedule = true;
+		}
+	}
+	const double deadline = vault->seal_deadline;
+	const bool schedule_rekey = sealed && !vault->next_key_ready;
+	pthread_mutex_unlock(&vault->mutex);
+
+	if (reschedule) {
+		vault_schedule_seal(vault, deadline);
+	}
+	if (schedule_rekey) {
+		vault_schedule_rekey(vault);
+	}
+}
+
+static void vault_seal_deferred(struct vault_t *vault) {
+	vault_seal_pending(vault, false);
+}
+
+/* Decrypts a vault ahead of an announced opening. It then stays decrypted
+ * until the warm-up deadline, so that the opening is served without waiting
+ * for the key derivation. */
+static void vault_decrypt_ahead(struct vault_t *vault) {
+	pthread_mutex_lock(&vault->mutex);
+	const double deadline = vault->warm_up_deadline;
+	bool schedule_seal = false;
+	if ((vault->reference_count == 0) && !vault->seal_pending && (now() < deadline)) {
+		if (vault_decrypt(vault)) {
+			vault->stats.decrypt_count++;
+			vault->batch_size = 0;
+			vault->seal_pending = true;
+			vault->seal_deadline = deadline;
+			schedule_seal = true;
+		} else {
+			log_msg(LLVL_ERROR, "Unable to decrypt vault ahead of time.");
+		}
+	}
+	pthread_mutex_unlock(&vault->mutex);
+
+	if (schedule_seal) {
+		vault_schedule_seal(vault, deadline);
+	}
 }
 
+static struct vault_t *vault_pop_earliest_seal(double *deadline) {
+	struct vault_t **earliest = NULL;
+	for (struct vault_t **link = &seal_queue_head; *link; link = &(*link)->seal_queue_next) {
+		if (!earliest || ((*link)->seal_queue_deadline < (*earliest)->seal_queue_deadline)) {
+			earliest = link;
+		}
+	}
+	if (!earliest) {
+		return NULL;
+	}
+
+	struct vault_t *vault = *earliest;
+	*deadline = vault->seal_queue_deadline;
+	if (*deadline > now()) {
+		return NULL;
+	}
+	*earliest = vault->seal_queue_next;
+	vault->seal_queue_next = NULL;
+	vault->seal_queued = false;
+	return vault;
+}
+
+static void vault_background_thread(void *vctx) {
+	pthread_mutex_lock(&background_mutex);
+	while (true) {
+		struct vault_t *vault = NULL;
+		void (*action)(struct vault_t *vault) = NULL;
+		double deadline = 0;
+
+		if (warm_up_queue_head) {
+			/* A client is waiting for these, so they take precedence */
+			vault = warm_up_queue_head;
+			warm_up_queue_head = vault->warm_up_queue_next;
+			vault->warm_up_queue_next = NULL;
+			vault->warm_up_queued = false;
+			action = vault_decrypt_ahead;
+		} else if (rekey_queue_head) {
+			vault = rekey_queue_head;
+			rekey_queue_head = vault->rekey_queue_next;
+			vault->rekey_queue_next = NULL;
+			vault->rekey_queued = false;
+			action = vault_prepare_next_key;
+		} else if ((vault = vault_pop_earliest_seal(&deadline)) != NULL) {
+			action = vault_seal_deferred;
+		} else if (deadline > 0) {
+			/* Wait until the next vault needs to be sealed */
+			struct timespec abstime = {
+				.tv_sec = (time_t)deadline,
+				.tv_nsec = (deadline - (time_t)deadline) * 1e9,
+			};
+			pthread_cond_timedwait(&background_cond, &background_mutex, &abstime);
+			continue;
+		} else {
+			pthread_cond_wait(&background_cond, &background_mutex);
+			continue;
+		}
+
+		vault->background_in_progress = true;
+		pthread_mutex_unlock(&background_mutex);
+
+		action(vault);
+
+		pthread_mutex_lock(&background_mutex);
+		vault->background_in_progress = false;
+		pthread_cond_broadcast(&background_done_cond);
+	}
+}
+
+/* Must be called with the background mutex held */
+static bool vault_start_background_thread(void) {
+	if (!background_thread_running) {
+		background_thread_running = pthread_create_detached_thread(vault_background_thread, &background_thread_running, 0);
+		if (!background_thread_running) {
+			/* Vaults will simply re-key synchronously when opened and seal
+			 * immediately when closed */
+			log_msg(LLVL_WARNING, "Unable to start background vault thread.");
+		}
+	}
+	return background_thread_running;
+}
+
+static void vault_schedule_rekey(struct vault_t *vault) {
+	pthread_mutex_lock(&background_mutex);
+	if (vault_start_background_thread() && !vault->rekey_queued) {
+		vault->rekey_queued = true;
+		vault->rekey_queue_next = rekey_queue_head;
+		rekey_queue_head = vault;
+		pthread_cond_signal(&background_cond);
+	}
+	pthread_mutex_unlock(&background_mutex);
+}
+
+/* Returns false if there is no background thread to seal the vault */
+static bool vault_schedule_seal(struct vault_t *vault, double deadline) {
+	pthread_mutex_lock(&background_mutex);
+	const bool scheduled = vault_start_background_thread();
+	if (scheduled) {
+		if (!vault->seal_queued) {
+			vault->seal_queued = true;
+			vault->seal_queue_next = seal_queue_head;
+			seal_queue_head = vault;
+		}
+		vault->seal_queue_deadline = deadline;
+		pthread_cond_signal(&background_cond);
+	}
+	pthread_mutex_unlock(&background_mutex);
+	return scheduled;
+}
+
+static void vault_schedule_warm_up(struct vault_t *vault) {
+	pthread_mutex_lock(&background_mutex);
+	if (vault_start_background_thread() && !vault->warm_up_queued) {
+		vault->warm_up_queued = true;
+		vault->warm_up_queue_next = warm_up_queue_head;
+		warm_up_queue_head = vault;
+		pthread_cond_signal(&background_cond);
+	}
+	pthread_mutex_unlock(&background_mutex);
+}
+
+static void vault_unschedule_background(struct vault_t *vault) {
+	pthread_mutex_lock(&background_mutex);
+	if (vault->rekey_queued) {
+		struct vault_t **link = &rekey_queue_head;
+		while (*link != vault) {
+			link = &(*link)->rekey_queue_next;
+		}
+		*link = vault->rekey_queue_next;
+		vault->rekey_queued = false;
+	}
+	if (vault->seal_queued) {
+		struct vault_t **link = &seal_queue_head;
+		while (*link != vault) {
+			link = &(*link)->seal_queue_next;
+		}
+		*link = vault->seal_queue_next;
+		vault->seal_queued = false;
+	}
+	if (vault->warm_up_queued) {
+		struct vault_t **link = &warm_up_queue_head;
+		while (*link != vault) {
+			link = &(*link)->warm_up_queue_next;
+		}
+		*link = vault->warm_up_queue_next;
+		vault->warm_up_queued = false;
+	}
+	while (vault->background_in_progress) {
+		pthread_cond_wait(&background_done_cond, &background_mutex);
+	}
+	pthread_mutex_unlock(&background_mutex);
+}
+
+/* Switches over to the key material that was prepared in the background. If
+ * none is available (yet), re-keys synchronously. */
+static bool vault_rekey_from_next(struct vault_t *vault) {
+	if (!vault->next_key_ready) {
+		return vault_rekey(vault);
+	}
+
+	uint8_t *old_source_key = vault->source_key;
+	vault->source_key = vault->next_source_key;
+	vault->next_source_key = old_source_key;
+	memcpy(vault->dkey, vault->next_dkey, sizeof(vault->dkey));
+	OPENSSL_cleanse(vault->next_source_key, vault->source_key_length);
+	OPENSSL_cleanse(vault->next_dkey, sizeof(vault->next_dkey));
+	vault->next_key_ready = false;
+	return true;
+}
+
+/* Measures the CPU time spent in all KDF lanes combined, not the wall-clock
+ * time. This way, the work factor of the derivation stays the same regardless
+ * of how many lanes it is split into. */
 static double vault_measure_key_derivation_time(struct vault_t *vault, unsigned int new_iteration_count) {
 	uint8_t dkey[32];
-	double t0, t1;
+	double cpu_time = 0;
 	vault->iteration_cnt = new_iteration_count;
-	t0 = now();
-	vault_derive_key(vault, dkey);
-	t1 = now();
+	vault_derive_key(vault, vault->source_key, dkey, &cpu_time);
 	OPENSSL_cleanse(dkey, sizeof(dkey));
-	return t1 - t0;
+	return cpu_time;
 }
 
 static void vault_calibrate_derivation_time(struct vault_t *vault, double target_derivation_time) {
@@ -75,7 +435,7 @@ static void vault_calibrate_derivation_time(struct vault_t *vault, double target
 	}
 }
 
-struct vault_t* vault_init(unsigned int data_length, double target_decryption_time) {
+static struct vault_t* vault_alloc(unsigned int data_length, unsigned int kdf_lanes) {
 	struct vault_t *vault;
 
 	vault = calloc(1, sizeof(struct vault_t));
@@ -89,8 +449,14 @@ struct vault_t* vault_init(unsigned int data_length, double target_decryption_ti
 		return NULL;
 	}
 	vault->source_key_length = DEFAULT_SOURCE_KEY_LENGTH_BYTES;
+	if (kdf_lanes == 0) {
+		long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+		kdf_lanes = (cpu_count > 0) ? cpu_count : 1;
+	}
+	vault->kdf_lanes = (kdf_lanes < VAULT_MAX_KDF_LANES) ? kdf_lanes : VAULT_MAX_KDF_LANES;
 	vault->source_key = malloc(vault->source_key_length);
-	if (!vault->source_key) {
+	vault->next_source_key = malloc(vault->source_key_length);
+	if (!vault->source_key || !vault->next_source_key) {
 		vault_free(vault);
 		return NULL;
 	}
@@ -102,6 +468,35 @@ struct vault_t* vault_init(unsigned int data_length, double target_decryption_ti
 	}
 	vault->reference_count = 1;
 	vault->data_length = data_length;
+	return vault;
+}
+
+/* Creates a vault with a known iteration count, e.g., one that was
+ * previously calibrated by vault_init(). Saves the expensive calibration when
+ * many vaults are created at once. */
+struct vault_t* vault_init_with_iteration_count(unsigned int data_length, unsigned int iteration_cnt, unsigned int kdf_lanes) {
+	struct vault_t *vault = vault_alloc(data_length, kdf_lanes);
+	if (!vault) {
+		return NULL;
+	}
+	vault->iteration_cnt = iteration_cnt;
+
+	/* Initially gernerate a full key and derive the dkey already (vault is
+	 * open at this point) */
+	if (!vault_rekey(vault)) {
+		vault_free(vault);
+		return NULL;
+	}
+
+	return vault;
+}
+
+/* A kdf_lanes value of zero uses one lane per online CPU. */
+struct vault_t* vault_init(unsigned int data_length, double target_decryption_time, unsigned int kdf_lanes) {
+	struct vault_t *vault = vault_alloc(data_length, kdf_lanes);
+	if (!vault) {
+		return NULL;
+	}
 
 	/* Decryption takes *two* derivations, one for the current key (to decrypt)
 	 * and another in advance after re-keying, therefore we halve the time
@@ -125,20 +520,26 @@ static void vault_destroy_content(struct vault_t *vault) {
 	if (vault->source_key) {
 		OPENSSL_cleanse(vault->source_key, vault->source_key_length);
 	}
+	if (vault->next_source_key) {
+		OPENSSL_cleanse(vault->next_source_key, vault->source_key_length);
+	}
+	OPENSSL_cleanse(vault->next_dkey, sizeof(vault->next_dkey));
+	vault->next_key_ready = false;
 }
 
 static bool vault_decrypt(struct vault_t *vault) {
 	/* At this point we only have the source key, not the dkey yet. Derive the
 	 * dkey into a local piece of memory first */
 	uint8_t dkey[32];
-	if (!vault_derive_key(vault, dkey)) {
+	if (!vault_derive_key(vault, vault->source_key, dkey, NULL)) {
 		OPENSSL_cleanse(dkey, sizeof(dkey));
 		return false;
 	}
 
 	/* Then rekey the vault for the upcoming closing. Do this while the vault
-	 * is still encrypted to minimize window of opportunity. */
-	if (!vault_rekey(vault)) {
+	 * is still encrypted to minimize window of opportunity. Usually the new
+	 * key material has already been prepared in the background. */
+	if (!vault_rekey_from_next(vault)) {
 		OPENSSL_cleanse(dkey, sizeof(dkey));
 		return false;
 	}
@@ -197,9 +598,21 @@ bool vault_open(struct vault_t *vault) {
 	bool success = true;
 	pthread_mutex_lock(&vault->mutex);
 	vault->reference_count++;
+	vault->stats.open_count++;
 	if (vault->reference_count == 1) {
-		/* Vault was closed, we need to decrypt it. */
-		success = vault_decrypt(vault);
+		if (vault->seal_pending) {
+			/* Vault is still decrypted from a previous opening, sealing was
+			 * deferred. Serve this request from the same decryption. */
+			vault->seal_pending = false;
+			vault->batch_size++;
+		} else {
+			/* Vault was closed, we need to decrypt it. */
+			success = vault_decrypt(vault);
+			vault->stats.decrypt_count++;
+			vault->batch_size = 1;
+		}
+	} else {
+		vault->batch_size++;
 	}
 	pthread_mutex_unlock(&vault->mutex);
 	return success;
@@ -265,25 +678,101 @@ static bool vault_encrypt(struct vault_t *vault) {
 
 bool vault_close(struct vault_t *vault) {
 	bool success = true;
+	bool schedule_rekey = false;
+	bool schedule_seal = false;
 	pthread_mutex_lock(&vault->mutex);
 	vault->reference_count--;
 	if (vault->reference_count == 0) {
-		/* Vault is now closed, we need to encrypt it. */
-		success = vault_encrypt(vault);
+		const double current_time = now();
+		double deadline = vault->warm_up_deadline;
+		if ((vault->coalesce_window > 0) && (vault->batch_size < vault->coalesce_max_batch) && (current_time + vault->coalesce_window > deadline)) {
+			deadline = current_time + vault->coalesce_window;
+		}
+		if (deadline > current_time) {
+			/* Keep the vault decrypted for a short while so that requests
+			 * arriving in close succession share one decryption, or because
+			 * a warm-up announced further clients */
+			vault->seal_pending = true;
+			vault->seal_deadline = deadline;
+			schedule_seal = true;
+		} else {
+			/* Vault is now closed, we need to encrypt it. */
+			success = vault_encrypt(vault);
+			schedule_rekey = success && !vault->next_key_ready;
+			if (vault->coalesce_window > 0) {
+				vault_log_coalesced_batch(vault);
+			}
+		}
 	}
+	const double seal_deadline = vault->seal_deadline;
 	pthread_mutex_unlock(&vault->mutex);
+
+	if (schedule_seal && !vault_schedule_seal(vault, seal_deadline)) {
+		/* Nobody would seal the vault later on, so it cannot be kept
+		 * decrypted for coalescing or warm-up */
+		vault_seal_pending(vault, true);
+	}
+	if (schedule_rekey) {
+		/* Prepare the key material for the next opening while nobody is
+		 * waiting for it */
+		vault_schedule_rekey(vault);
+	}
 	return success;
 }
 
 
+/* Enables coalescing of vault openings: when the last user closes the vault,
+ * it is only sealed after window_secs have passed without it being opened
+ * again, or once max_batch requests have been served from one decryption. A
+ * window of zero seals immediately. */
+void vault_set_coalescing(struct vault_t *vault, double window_secs, unsigned int max_batch) {
+	pthread_mutex_lock(&vault->mutex);
+	vault->coalesce_window = window_secs;
+	vault->coalesce_max_batch = max_batch;
+	pthread_mutex_unlock(&vault->mutex);
+}
+
+/* Announces that the vault is likely going to be opened within the next
+ * ttl_secs. It is then decrypted in the background right away and kept
+ * decrypted until the TTL has passed, after which it is sealed again unless
+ * it is still in use. Decryption happens at most once per warm-up period,
+ * regardless of how often this is called. */
+void vault_warm_up(struct vault_t *vault, double ttl_secs) {
+	pthread_mutex_lock(&vault->mutex);
+	const double deadline = now() + ttl_secs;
+	if (deadline > vault->warm_up_deadline) {
+		vault->warm_up_deadline = deadline;
+	}
+	if (vault->seal_pending && (deadline > vault->seal_deadline)) {
+		/* Still decrypted, the background thread picks up the new deadline
+		 * once the old one has passed */
+		vault->seal_deadline = deadline;
+	}
+	vault->stats.warm_up_count++;
+	const bool needs_decryption = (vault->reference_count == 0) && !vault->seal_pending;
+	pthread_mutex_unlock(&vault->mutex);
+
+	if (needs_decryption) {
+		vault_schedule_warm_up(vault);
+	}
+}
+
+void vault_get_stats(struct vault_t *vault, struct vault_stats_t *stats) {
+	pthread_mutex_lock(&vault->mutex);
+	*stats = vault->stats;
+	pthread_mutex_unlock(&vault->mutex);
+}
+
 void vault_free(struct vault_t *vault) {
 	if (!vault) {
 		return;
 	}
+	vault_unschedule_background(vault);
 	pthread_mutex_destroy(&vault->mutex);
 	vault_destroy_content(vault);
 	free(vault->data);
 	free(vault->source_key);
+	free(vault->next_source_key);
 	free(vault);
 }
 
@@ -297,9 +786,9 @@ static void dump(const uint8_t *data, unsigned int length) {
 }
 
 int main(void) {
-	/* gcc -D__TEST_VAULT__ -Wall -std=c11 -Wmissing-prototypes -Wstrict-prototypes -Werror=implicit-function-declaration -Wimplicit-fallthrough -Wshadow -pie -fPIE -fsanitize=address -fsanitize=undefined -fsanitize=leak -pthread -o vault vault.c util.c log.c -lcrypto
+	/* gcc -D__TEST_VAULT__ -Wall -std=c11 -Wmissing-prototypes -Wstrict-prototypes -Werror=implicit-function-declaration -Wimplicit-fallthrough -Wshadow -pie -fPIE -fsanitize=address -fsanitize=undefined -fsanitize=leak -pthread -o vault vault.c util.c log.c thread.c -lcrypto
 	 */
-	struct vault_t *vault = vault_init(64, 1);
+	struct vault_t *vault = vault_init(64, 1, 0);
 	dump(vault->data, vault->data_length);
 	for (int i = 0; i < 10; i++) {
 		if (!vault_close(vault)) {
@@ -315,6 +804,22 @@ int main(void) {
 		dump(vault->data, vault->data_length);
 	}
 	vault_free(vault);
+
+	/* Calibration must yield the same total work regardless of the number
+	 * of lanes, even when there are more lanes than CPUs */
+	unsigned int single_lane_iterations = 0;
+	for (unsigned int kdf_lanes = 1; kdf_lanes <= 8; kdf_lanes *= 2) {
+		vault = vault_init(64, 0.5, kdf_lanes);
+		const unsigned int total_iterations = vault->iteration_cnt * vault->kdf_lanes;
+		fprintf(stderr, "%u lanes: %u x %u = %u iterations\n", vault->kdf_lanes, vault->kdf_lanes, vault->iteration_cnt, total_iterations);
+		if (kdf_lanes == 1) {
+			single_lane_iterations = total_iterations;
+		} else if (total_iterations < single_lane_iterations * 3 / 4) {
+			fprintf(stderr, "total iteration count dropped with %u lanes.\n", kdf_lanes);
+			abort();
+		}
+		vault_free(vault);
+	}
 	return 0;
 }
 #endif
@@ -28,6 +28,12 @@
 #include <stdint.h>
 #include <pthread.h>
 
+struct vault_stats_t {
+	uint64_t open_count;
+	uint64_t decrypt_count;
+	uint64_t warm_up_count;
+};
+
 struct vault_t {
 	pthread_mutex_t mutex;
 	unsigned int reference_count;
@@ -39,14 +45,50 @@ struct vault_t {
 	uint8_t dkey[32];
 	uint64_t iv;
 	unsigned int iteration_cnt;
+	unsigned int kdf_lanes;
+
+	/* Source key and dkey for the next re-keying, prepared in the background
+	 * while the vault is closed. Guarded by the vault mutex. */
+	uint8_t *next_source_key;
+	uint8_t next_dkey[32];
+	bool next_key_ready;
+
+	/* Coalescing of openings, guarded by the vault mutex */
+	double coalesce_window;
+	unsigned int coalesce_max_batch;
+	bool seal_pending;
+	double seal_deadline;
+	unsigned int batch_size;
+	struct vault_stats_t stats;
+
+	/* Until this point in time, the vault is kept decrypted because a client
+	 * announced that it is about to open it. Guarded by the vault mutex. */
+	double warm_up_deadline;
+
+	/* Guarded by the global background thread mutex */
+	struct vault_t *rekey_queue_next;
+	bool rekey_queued;
+	struct vault_t *seal_queue_next;
+	bool seal_queued;
+	double seal_queue_deadline;
+	struct vault_t *warm_up_queue_next;
+	bool warm_up_queued;
+	bool background_in_progress;
 };
 
 #define DEFAULT_SOURCE_KEY_LENGTH_BYTES		(1024 * 1024)
 
+/* Maximum number of parallel lanes the source key derivation is split into */
+#define VAULT_MAX_KDF_LANES					16
+
 /*************** AUTO GENERATED SECTION FOLLOWS ***************/
-struct vault_t* vault_init(unsigned int data_length, double target_derivation_time);
+struct vault_t* vault_init_with_iteration_count(unsigned int data_length, unsigned int iteration_cnt, unsigned int kdf_lanes);
+struct vault_t* vault_init(unsigned int data_length, double target_derivation_time, unsigned int kdf_lanes);
 bool vault_open(struct vault_t *vault);
 bool vault_close(struct vault_t *vault);
+void vault_set_coalescing(struct vault_t *vault, double window_secs, unsigned int max_batch);
+void vault_warm_up(struct vault_t *vault, double ttl_secs);
+void vault_get_stats(struct vault_t *vault, struct vault_stats_t *stats);
 void vault_free(struct vault_t *vault);
 /***************  AUTO GENERATED SECTION ENDS   ***************/
 
@@ -27,34 +27,40 @@
 #include "vaulted_keydb.h"
 #include "log.h"
 
-static struct tls_psk_vault_entry_t *vaulted_keydb_get_tls_psk_for_hostindex(struct vaulted_keydb_t *vkeydb, unsigned int host_index) {
-	return ((struct tls_psk_vault_entry_t*)vkeydb->tls_psk_vault->data) + host_index;
+static struct vaulted_keydb_shard_t *vaulted_keydb_get_shard_for_hostindex(struct vaulted_keydb_t *vkeydb, unsigned int host_index) {
+	return &vkeydb->shards[host_index % vkeydb->shard_count];
 }
 
-static struct luks_passphrase_vault_entry_t *vaulted_keydb_get_luks_passphrase_for_hostindex(struct vaulted_keydb_t *vkeydb, unsigned int host_index) {
-	return ((struct luks_passphrase_vault_entry_t*)vkeydb->luks_passphrase_vault->data) + host_index;
+static struct host_credentials_vault_entry_t *vaulted_keydb_get_credentials_for_hostindex(struct vaulted_keydb_t *vkeydb, unsigned int host_index) {
+	struct vaulted_keydb_shard_t *shard = vaulted_keydb_get_shard_for_hostindex(vkeydb, host_index);
+	return ((struct host_credentials_vault_entry_t*)shard->vault->data) + (host_index / vkeydb->shard_count);
 }
 
 static void move_data_into_vault(struct vaulted_keydb_t *dest, keydb_t *src) {
 	for (unsigned int i = 0; i < src->host_count; i++) {
 		host_entry_t *host = &src->hosts[i];
+		struct host_credentials_vault_entry_t *dest_credentials = vaulted_keydb_get_credentials_for_hostindex(dest, i);
 
 		/* Copy over TLS-PSK and remove original */
-		struct tls_psk_vault_entry_t *dest_tls_psk = vaulted_keydb_get_tls_psk_for_hostindex(dest, i);
-		memcpy(&dest_tls_psk->tls_psk, host->tls_psk, PSK_SIZE_BYTES);
+		memcpy(&dest_credentials->tls_psk, host->tls_psk, PSK_SIZE_BYTES);
 		OPENSSL_cleanse(host->tls_psk, PSK_SIZE_BYTES);
 
 		/* Copy over all LUKS keys and remove originals */
-		struct luks_passphrase_vault_entry_t *dest_luks_passphrase = vaulted_keydb_get_luks_passphrase_for_hostindex(dest, i);
 		for (unsigned int j = 0; j < host->volume_count; j++) {
 			volume_entry_t *volume = &host->volumes[j];
-			memcpy(&dest_luks_passphrase->volumes[j].luks_passphrase_raw, volume->luks_passphrase_raw, LUKS_PASSPHRASE_RAW_SIZE_BYTES);
+			memcpy(&dest_credentials->volumes[j].luks_passphrase_raw, volume->luks_passphrase_raw, LUKS_PASSPHRASE_RAW_SIZE_BYTES);
 			OPENSSL_cleanse(volume->luks_passphrase_raw, LUKS_PASSPHRASE_RAW_SIZE_BYTES);
+			dest_credentials->volumes[j].luks_volume_key_length = volume->luks_volume_key_length;
+			memcpy(&dest_credentials->volumes[j].luks_volume_key, volume->luks_volume_key, LUKS_VOLUME_KEY_MAX_SIZE_BYTES);
+			OPENSSL_cleanse(volume->luks_volume_key, LUKS_VOLUME_KEY_MAX_SIZE_BYTES);
 		}
 	}
 }
 
-bool vaulted_keydb_get_tls_psk(struct vaulted_keydb_t *vaulted_keydb, uint8_t dest[PSK_SIZE_BYTES], const host_entry_t *host) {
+/* Retrieves TLS-PSK and all LUKS passphrases of a host while opening the
+ * vault only once. The caller owns the copy and must OPENSSL_cleanse() it as
+ * soon as it is no longer needed. */
+bool vaulted_keydb_get_host_credentials(struct vaulted_keydb_t *vaulted_keydb, struct host_credentials_vault_entry_t *dest, const host_entry_t *host) {
 	int host_index = keydb_get_host_index(vaulted_keydb->keydb, host);
 	if (host_index < 0) {
 		log_msg(LLVL_FATAL, "Unable to retrieve host index for vaulted key db entry.");
@@ -62,57 +68,55 @@ bool vaulted_keydb_get_tls_psk(struct vaulted_keydb_t *vaulted_keydb, uint8_t de
 	}
 
 	/* Get a pointer into the vaulted structure */
-	struct tls_psk_vault_entry_t *entry = vaulted_keydb_get_tls_psk_for_hostindex(vaulted_keydb, host_index);
+	struct vault_t *vault = vaulted_keydb_get_shard_for_hostindex(vaulted_keydb, host_index)->vault;
+	struct host_credentials_vault_entry_t *entry = vaulted_keydb_get_credentials_for_hostindex(vaulted_keydb, host_index);
 
 	/* Then decrypt vault */
-	if (!vault_open(vaulted_keydb->tls_psk_vault)) {
-		log_msg(LLVL_FATAL, "Unable to open TLS-PSK vault of vaulted key db entry.");
+	if (!vault_open(vault)) {
+		log_msg(LLVL_FATAL, "Unable to open vault of vaulted key db entry.");
 		return false;
 	}
 
 	/* Copy out the data we need */
-	memcpy(dest, &entry->tls_psk, PSK_SIZE_BYTES);
+	memcpy(dest, entry, sizeof(struct host_credentials_vault_entry_t));
 
 	/* And close it back up */
-	if (!vault_close(vaulted_keydb->tls_psk_vault)) {
-		OPENSSL_cleanse(dest, PSK_SIZE_BYTES);
-		log_msg(LLVL_FATAL, "Unable to close TLS-PSK vault of vaulted key db entry.");
+	if (!vault_close(vault)) {
+		OPENSSL_cleanse(dest, sizeof(struct host_credentials_vault_entry_t));
+		log_msg(LLVL_FATAL, "Unable to close vault of vaulted key db entry.");
 		return false;
 	}
 
 	return true;
 }
 
-bool vaulted_keydb_get_volume_luks_passphases_raw(struct vaulted_keydb_t *vaulted_keydb, void (*copy_callback)(void *vctx, unsigned int volume_index, const void *source), void *copy_ctx, const host_entry_t *host) {
-	int host_index = keydb_get_host_index(vaulted_keydb->keydb, host);
-	if (host_index < 0) {
-		log_msg(LLVL_FATAL, "Unable to retrieve host index for vaulted key db entry.");
-		return false;
-	}
-
-	/* Get a pointer into the vaulted structure */
-	struct luks_passphrase_vault_entry_t *entry = vaulted_keydb_get_luks_passphrase_for_hostindex(vaulted_keydb, host_index);
-
-	/* Then decrypt vault */
-	if (!vault_open(vaulted_keydb->luks_passphrase_vault)) {
-		log_msg(LLVL_FATAL, "Unable to open LUKS passphrase vault of vaulted key db entry.");
-		return false;
-	}
-
-	/* Copy out the data we need by calling back for all volumes */
-	for (unsigned int i = 0; i < host->volume_count; i++) {
-		copy_callback(copy_ctx, i, &entry->volumes[i].luks_passphrase_raw);
-	}
-
-	/* And close it back up */
-	if (!vault_close(vaulted_keydb->luks_passphrase_vault)) {
-		log_msg(LLVL_FATAL, "Unable to close LUKS passphrase vault of vaulted key db entry.");
-		return false;
+static bool vaulted_keydb_create_shards(struct vaulted_keydb_t *vaulted_keydb, unsigned int kdf_lanes) {
+	/* Every shard holds the same number of host slots, the last ones might
+	 * not be fully used */
+	const unsigned int hosts_per_shard = (vaulted_keydb->keydb->host_count + vaulted_keydb->shard_count - 1) / vaulted_keydb->shard_count;
+	const unsigned int vault_size = sizeof(struct host_credentials_vault_entry_t) * hosts_per_shard;
+
+	/* Only calibrate the key derivation once, all other vaults reuse the
+	 * iteration count */
+	for (unsigned int i = 0; i < vaulted_keydb->shard_count; i++) {
+		struct vaulted_keydb_shard_t *shard = &vaulted_keydb->shards[i];
+		if (i == 0) {
+			shard->vault = vault_init(vault_size, 0.025, kdf_lanes);
+		} else {
+			shard->vault = vault_init_with_iteration_count(vault_size, vaulted_keydb->shards[0].vault->iteration_cnt, kdf_lanes);
+		}
+		if (!shard->vault) {
+			log_msg(LLVL_FATAL, "Unable to create vault for shard %u", i);
+			return false;
+		}
 	}
 	return true;
 }
 
-struct vaulted_keydb_t *vaulted_keydb_new(keydb_t *keydb) {
+/* A shard_count of zero creates one shard per host (up to
+ * VAULTED_KEYDB_MAX_SHARDS), a kdf_lanes count of zero derives vault keys using
+ * all online CPUs. */
+struct vaulted_keydb_t *vaulted_keydb_new(keydb_t *keydb, unsigned int shard_count, unsigned int kdf_lanes) {
 	struct vaulted_keydb_t *vaulted_keydb = calloc(1, sizeof(struct vaulted_keydb_t));
 	if (!vaulted_keydb) {
 		log_msg(LLVL_FATAL, "Unable to calloc(3) vaulted keydb");
@@ -120,17 +124,26 @@ struct vaulted_keydb_t *vaulted_keydb_new(keydb_t *keydb) {
 	}
 
 	vaulted_keydb->keydb = keydb;
-
-	vaulted_keydb->tls_psk_vault = vault_init(sizeof(struct tls_psk_vault_entry_t) * keydb->host_count, 0.025);
-	if (!vaulted_keydb->tls_psk_vault) {
-		log_msg(LLVL_FATAL, "Unable to create TLS-PSK vault");
+	if ((shard_count == 0) || (shard_count > keydb->host_count)) {
+		shard_count = keydb->host_count;
+	}
+	if (shard_count == 0) {
+		/* Empty key database still gets one (empty) shard */
+		shard_count = 1;
+	}
+	if (shard_count > VAULTED_KEYDB_MAX_SHARDS) {
+		log_msg(LLVL_WARNING, "Limiting vaulted key database to %u shards instead of %u.", VAULTED_KEYDB_MAX_SHARDS, shard_count);
+		shard_count = VAULTED_KEYDB_MAX_SHARDS;
+	}
+	vaulted_keydb->shard_count = shard_count;
+	vaulted_keydb->shards = calloc(shard_count, sizeof(struct vaulted_keydb_shard_t));
+	if (!vaulted_keydb->shards) {
+		log_msg(LLVL_FATAL, "Unable to calloc(3) %u vaulted keydb shards", shard_count);
 		vaulted_keydb_free(vaulted_keydb);
 		return NULL;
 	}
 
-	vaulted_keydb->luks_passphrase_vault = vault_init(sizeof(struct luks_passphrase_vault_entry_t) * keydb->host_count, 0.025);
-	if (!vaulted_keydb->luks_passphrase_vault) {
-		log_msg(LLVL_FATAL, "Unable to create LUKS passphrase vault");
+	if (!vaulted_keydb_create_shards(vaulted_keydb, kdf_lanes)) {
 		vaulted_keydb_free(vaulted_keydb);
 		return NULL;
 	}
@@ -140,26 +153,49 @@ struct vaulted_keydb_t *vaulted_keydb_new(keydb_t *keydb) {
 	move_data_into_vault(vaulted_keydb, keydb);
 
 	/* Finally, close the vaults */
-	if (!vault_close(vaulted_keydb->tls_psk_vault)) {
-		log_msg(LLVL_FATAL, "Failed to close TLS-PSK vault");
-		vaulted_keydb_free(vaulted_keydb);
-		return NULL;
+	for (unsigned int i = 0; i < vaulted_keydb->shard_count; i++) {
+		if (!vault_close(vaulted_keydb->shards[i].vault)) {
+			log_msg(LLVL_FATAL, "Failed to close vault of shard %u", i);
+			vaulted_keydb_free(vaulted_keydb);
+			return NULL;
+		}
 	}
+	log_msg(LLVL_DEBUG, "Vaulted key database for %u hosts in %u shards, key derivation uses %u lanes with %u iterations.", keydb->host_count, vaulted_keydb->shard_count, vaulted_keydb->shards[0].vault->kdf_lanes, vaulted_keydb->shards[0].vault->iteration_cnt);
 
-	if (!vault_close(vaulted_keydb->luks_passphrase_vault)) {
-		log_msg(LLVL_FATAL, "Failed to close LUKS passhrase vault");
-		vaulted_keydb_free(vaulted_keydb);
-		return NULL;
+	return vaulted_keydb;
+}
+
+void vaulted_keydb_set_coalescing(struct vaulted_keydb_t *vaulted_keydb, unsigned int window_millis, unsigned int max_batch) {
+	for (unsigned int i = 0; i < vaulted_keydb->shard_count; i++) {
+		vault_set_coalescing(vaulted_keydb->shards[i].vault, window_millis / 1000., max_batch);
 	}
+	if (window_millis) {
+		log_msg(LLVL_DEBUG, "Coalescing vault openings within %u ms, at most %u requests per decryption.", window_millis, max_batch);
+	}
+}
 
-	return vaulted_keydb;
+/* Starts decrypting the shard of a host that announced itself during
+ * discovery, so that its credentials are readily available once it connects.
+ * The shard is sealed again after ttl_millis if the host does not show up. */
+bool vaulted_keydb_warm_up(struct vaulted_keydb_t *vaulted_keydb, const host_entry_t *host, unsigned int ttl_millis) {
+	int host_index = keydb_get_host_index(vaulted_keydb->keydb, host);
+	if (host_index < 0) {
+		log_msg(LLVL_ERROR, "Unable to retrieve host index for vault warm-up.");
+		return false;
+	}
+	vault_warm_up(vaulted_keydb_get_shard_for_hostindex(vaulted_keydb, host_index)->vault, ttl_millis / 1000.);
+	return true;
 }
 
 void vaulted_keydb_free(struct vaulted_keydb_t *vaulted_keydb) {
 	if (!vaulted_keydb) {
 		return;
 	}
-	vault_free(vaulted_keydb->luks_passphrase_vault);
-	vault_free(vaulted_keydb->tls_psk_vault);
+	if (vaulted_keydb->shards) {
+		for (unsigned int i = 0; i < vaulted_keydb->shard_count; i++) {
+			vault_free(vaulted_keydb->shards[i].vault);
+		}
+		free(vaulted_keydb->shards);
+	}
 	free(vaulted_keydb);
 }
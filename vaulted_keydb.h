@@ -27,26 +27,38 @@
 #include "keydb.h"
 #include "vault.h"
 
-struct tls_psk_vault_entry_t {
+/* Everything a host needs is kept in one vault entry so that it can be
+ * retrieved with a single vault opening */
+struct host_credentials_vault_entry_t {
 	uint8_t tls_psk[PSK_SIZE_BYTES];
-};
-
-struct luks_passphrase_vault_entry_t {
 	struct {
 		uint8_t luks_passphrase_raw[LUKS_PASSPHRASE_RAW_SIZE_BYTES];
+		unsigned int luks_volume_key_length;
+		uint8_t luks_volume_key[LUKS_VOLUME_KEY_MAX_SIZE_BYTES];
 	} volumes[MAX_VOLUMES_PER_HOST];
 };
 
+/* Hosts are distributed round-robin among the shards so that clients of
+ * different shards can open their vaults concurrently */
+struct vaulted_keydb_shard_t {
+	struct vault_t *vault;
+};
+
+/* Every shard holds 2 MiB of pre-key material (current and next) and costs
+ * one key derivation at startup, so their number is limited */
+#define VAULTED_KEYDB_MAX_SHARDS							64
+
 struct vaulted_keydb_t {
 	keydb_t *keydb;
-	struct vault_t *tls_psk_vault;
-	struct vault_t *luks_passphrase_vault;
+	unsigned int shard_count;
+	struct vaulted_keydb_shard_t *shards;
 };
 
 /*************** AUTO GENERATED SECTION FOLLOWS ***************/
-bool vaulted_keydb_get_tls_psk(struct vaulted_keydb_t *vaulted_keydb, uint8_t dest[PSK_SIZE_BYTES], const host_entry_t *host);
-bool vaulted_keydb_get_volume_luks_passphases_raw(struct vaulted_keydb_t *vaulted_keydb, void (*copy_callback)(void *ctx, unsigned int volume_index, const void *source), void *copy_ctx, const host_entry_t *host);
-struct vaulted_keydb_t *vaulted_keydb_new(keydb_t *keydb);
+bool vaulted_keydb_get_host_credentials(struct vaulted_keydb_t *vaulted_keydb, struct host_credentials_vault_entry_t *dest, const host_entry_t *host);
+struct vaulted_keydb_t *vaulted_keydb_new(keydb_t *keydb, unsigned int shard_count, unsigned int kdf_lanes);
+void vaulted_keydb_set_coalescing(struct vaulted_keydb_t *vaulted_keydb, unsigned int window_millis, unsigned int max_batch);
+bool vaulted_keydb_warm_up(struct vaulted_keydb_t *vaulted_keydb, const host_entry_t *host, unsigned int ttl_millis);
 void vaulted_keydb_free(struct vaulted_keydb_t *vaulted_keydb);
 /***************  AUTO GENERATED SECTION ENDS   ***************/
 